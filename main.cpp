@@ -11,9 +11,40 @@
  *  that are compliant with the DV specification (IEC 61834-2) and that have:
  *  - SSYB packets (0x62 and 0x63) with the date and time information
  *
- *  Syntax: dv2str <video_file_path> [options]
+ *  Syntax: dv2str <video_file_path_or_directory> [more...] [options]
+ *          dv2str inspect <video_file_path>... [-d]   (-d also reads each 'strh' stream type)
+ *          dv2str validate <video_file_path>...
+ *          dv2str carve <disk_image_or_device> <output_directory>
+ *          dv2str tar <archive.tar|->...
+ *          dv2str catalog <file_or_directory>...       (one summary line per AVI, from the xattr cache)
+ *          dv2str probe <video_file_path>...
+ *          dv2str serve <port|unix:path> [--cache-size size] [-j slots]   (lookup service with an LRU cache)
+ *          dv2str ingest <socket_path>            (decode frames from a capture process in shared memory)
+ *          dv2str produce <socket_path> <video_file_path>   (test producer for ingest)
  *  Options:
  *  -debug: Print debug information
+ *  -j <n>: Number of files processed in parallel (default 1)
+ *  --depth <n>: Frames read ahead of the decoder per file (default 8)
+ *  --max-memory <size>: Memory budget for frame buffers and index windows (e.g. 64M, 1G)
+ *  --auto: Tune -j and --depth from measured throughput (they become upper bounds)
+ *  --background: Read with idle I/O priority (Linux)
+ *  --max-rate <MB/s>, --max-iops <n>: Cap the reads of all threads together
+ *  (SIGUSR1 halves the caps at runtime, SIGUSR2 doubles them)
+ *  --progress: Print frames, MB/s, frames/s and ETA to stderr every second
+ *  --progress-json: Same, as one JSON object per line for scripts
+ *  --metrics-file <path>: Write Prometheus metrics for the node_exporter textfile collector
+ *  --metrics-listen <port|unix:path>: Serve Prometheus metrics at /metrics while running
+ *  --scan-threads <n>: Threads scanning 'movi' of files without idx1 (default: all cores)
+ *  --crawl-threads <n>: Threads reading directories given as arguments, where DV AVIs are found by
+ *  their content rather than their extension (default: all cores, at least 4)
+ *  --write-index: Decode the frames and embed a timecode index chunk ('dvtc') in each AVI, which
+ *  later runs read instead of the frames
+ *  --frames-file <path>: Write every frame's result as fixed-size binary records, which
+ *  load_frame_records in main.py maps as a NumPy array without parsing
+ *  --numa: Spread the workers over the NUMA nodes, each pinned to its node's CPUs and memory
+ *  (no effect on single-node machines)
+ *  --stats: Print per-stage and per-thread timings, latency percentiles and hardware counters
+ *  --alloc-check: Fail if the read or decode stage allocated (builds with DV2STR_ALLOC_ACCOUNTING)
  *
  *  This program is licensed under the MIT License.
  *  (c) José Rodrigues, Tomás Gonçalves 2024
@@ -28,17 +59,85 @@
 #include <cstring>
 #include <cstdint>
 #include <cstdlib>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <array>
+#include <sstream>
+#include <optional>
+#include <new>
+#include <filesystem>
+#include <csignal>
+#include <cerrno>
+#include <functional>
+#include <list>
+#include <unordered_map>
 #include <map>
+#include <future>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <sched.h>
+#endif
 
 using namespace std;
 
 bool debug;
 
+// Largest DV frame (PAL) and the number of idx1 entries read per index window
+const size_t MAX_FRAME_SIZE = 144000;
+const size_t IDX1_ENTRY_SIZE = 16;
+const size_t MIN_INDEX_WINDOW = 256;
+const size_t MAX_INDEX_WINDOW = 65536;
+
+unsigned jobs = 1;
+size_t pipeline_depth = 8;
+size_t max_memory = 0; // 0 = unlimited
+bool auto_tune = false;
+bool background = false;
+double max_rate_mb = 0; // 0 = unlimited
+double max_iops = 0;
+bool stats = false;
+bool alloc_check = false;
+unsigned scan_threads = 0; // 0 = one per core
+enum ProgressMode { PROGRESS_OFF, PROGRESS_TEXT, PROGRESS_JSON } progress_mode = PROGRESS_OFF;
+string metrics_file;
+string metrics_listen;
+bool write_index = false;
+unsigned crawl_threads = max(4u, thread::hardware_concurrency()); // Directory reads are latency bound
+bool numa_placement = false;
+bool store_summaries = true; // Cache each decoded file's summary in its xattr (off in serve)
+string frames_file;
+
 // Function to read data from the file at a specific offset
 vector<uint8_t> read_chunk(ifstream &file, streampos offset, size_t size) {
     file.seekg(offset);
     vector<uint8_t> buffer(size);
     file.read(reinterpret_cast<char*>(buffer.data()), size);
+    buffer.resize(file.gcount());
     return buffer;
 }
 
@@ -52,33 +151,40 @@ string read_string(const vector<uint8_t> &data, size_t offset) {
     return string(reinterpret_cast<const char*>(&data[offset]), 4);
 }
 
-// Function to find the SSYB packet with the given packet number
-vector<uint8_t> get_ssyb_pack(const vector<uint8_t> &data, uint8_t pack_num) {
-    size_t seq_count = (data.size() >= 144000) ? 12 : 10; // PAL (10 sequences) or NTSC (12 sequences)
+// Recording date and time as {day, month, year, hour, min, sec}
+using Timecode = array<int, 6>;
+
+// Function to find the SSYB packet with the given packet number; points into data
+const uint8_t *get_ssyb_pack(const uint8_t *data, size_t size, uint8_t pack_num) {
+    size_t seq_count = (size >= 144000) ? 12 : 10; // PAL (10 sequences) or NTSC (12 sequences)
 
     for (size_t i = 0; i < seq_count; ++i) {
         for (size_t j = 0; j < 2; ++j) { // Each sequence has two DIF blocks with subcode data
             for (size_t k = 0; k < 6; ++k) { // Each block contains 6 packets
                 size_t offset = i * 150 * 80 + j * 80 + 3 + k * 8 + 3;
                 if (data[offset] == pack_num) {
-                    return vector<uint8_t>(data.begin() + offset, data.begin() + offset + 8);
+                    return &data[offset];
                 }
             }
         }
     }
-    return {}; // Return an empty vector if the packet is not found
+    return nullptr; // Return nullptr if the packet is not found
 }
 
-// Function to extract date and time from the DV stream
-vector<int> get_dv_recording_time(const vector<uint8_t> &data, const string &name, size_t offset) {
-    if (data.size() != 144000 && data.size() != 120000) {
-        return {}; // Return an empty vector if the size is not NTSC or PAL frame size
+const uint8_t *get_ssyb_pack(const vector<uint8_t> &data, uint8_t pack_num) {
+    return get_ssyb_pack(data.data(), data.size(), pack_num);
+}
+
+// Function to extract date and time from a DV frame in place (e.g. in shared memory)
+optional<Timecode> get_dv_recording_time(const uint8_t *data, size_t size, const string &name, size_t offset) {
+    if (size != 144000 && size != 120000) {
+        return {}; // Return nothing if the size is not NTSC or PAL frame size
     }
 
-    auto pack62 = get_ssyb_pack(data, 0x62); // Date packet
-    auto pack63 = get_ssyb_pack(data, 0x63); // Time packet
+    auto pack62 = get_ssyb_pack(data, size, 0x62); // Date packet
+    auto pack63 = get_ssyb_pack(data, size, 0x63); // Time packet
 
-    if (pack62.empty() || pack63.empty()) {
+    if (!pack62 || !pack63) {
         return {}; // Could not find required packets
     }
 
@@ -94,170 +200,4089 @@ vector<int> get_dv_recording_time(const vector<uint8_t> &data, const string &nam
     // Validation checks
     if (day < 1 || day > 31 || month < 1 || month > 12 || year < 1995 || year > 2100 ||
         sec < 0 || sec > 59 || min < 0 || min > 59 || hour < 0 || hour > 23) {
-        return {}; // Return an empty vector if any validation fails
+        return {}; // Return nothing if any validation fails
     }
 
-    return {day, month, year, hour, min, sec}; // Return the extracted date and time
+    return Timecode{day, month, year, hour, min, sec}; // Return the extracted date and time
 }
 
-// Define a base class for polymorphism
-struct Value {
-    virtual ~Value() = default;
-    virtual void print() const = 0;
+// Function to extract date and time from the DV stream
+optional<Timecode> get_dv_recording_time(const vector<uint8_t> &data, const string &name, size_t offset) {
+    return get_dv_recording_time(data.data(), data.size(), name, offset);
+}
+
+// Process-wide memory budget shared by every frame buffer pool and index window
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit) : limit(limit) {}
+
+    // Reserve bytes without waiting; fails if the budget would be exceeded
+    bool try_reserve(size_t bytes) {
+        lock_guard<mutex> lock(mtx);
+        if (limit != 0 && used + bytes > limit) return false;
+        used += bytes;
+        peak = max(peak, used);
+        return true;
+    }
+
+    // Reserve bytes, waiting for other files to release theirs if needed
+    void reserve(size_t bytes) {
+        unique_lock<mutex> lock(mtx);
+        released.wait(lock, [&] { return limit == 0 || used + bytes <= limit || used == 0; });
+        used += bytes;
+        peak = max(peak, used);
+    }
+
+    void release(size_t bytes) {
+        {
+            lock_guard<mutex> lock(mtx);
+            used -= bytes;
+        }
+        released.notify_all();
+    }
+
+    // Bytes that can still be reserved without waiting
+    size_t available() {
+        lock_guard<mutex> lock(mtx);
+        if (limit == 0) return SIZE_MAX;
+        return used >= limit ? 0 : limit - used;
+    }
+
+    size_t peak_usage() {
+        lock_guard<mutex> lock(mtx);
+        return peak;
+    }
+
+private:
+    mutex mtx;
+    condition_variable released;
+    size_t limit;
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+MemoryBudget *memory_budget = nullptr;
+
+// Reservation held against the global budget, released when it goes out of scope
+struct BudgetReservation {
+    size_t bytes = 0;
+    BudgetReservation() = default;
+    BudgetReservation(const BudgetReservation &) = delete;
+    BudgetReservation &operator=(const BudgetReservation &) = delete;
+    ~BudgetReservation() {
+        if (bytes) memory_budget->release(bytes);
+    }
+};
+
+// One idx1 entry as stored on disk (16 bytes)
+struct IndexEntry {
+    char stream_id[4];
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;
 };
 
-// Define derived classes to hold specific types
-struct StringValue : public Value {
-    string value;
-    explicit StringValue(const string& str) : value(str) {}
-    void print() const override {
-        cout << value;
+// Hill-climbing controller for the number of parallel files and the read-ahead depth.
+// Every interval it compares frames/s with the best seen so far: a step that improves
+// throughput is kept, a plateau or a latency spike reverts it and tries the other knob.
+class ConcurrencyTuner {
+public:
+    ConcurrencyTuner(unsigned max_jobs, size_t max_depth) : max_jobs(max_jobs), max_depth(max_depth) {}
+
+    void start() {
+        controller = thread(&ConcurrencyTuner::run, this);
     }
-    string getValue() const {
-        return value;
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        changed.notify_all();
+        controller.join();
+        cerr << "Auto-tune: settled on -j " << jobs_limit << " --depth " << depth_limit;
+        if (best_rate > 0) {
+            cerr << " (" << fixed << setprecision(1) << best_rate << " frames/s)";
+        }
+        cerr << endl;
+    }
+
+    void record_read(uint64_t nanoseconds) {
+        frames_read.fetch_add(1, memory_order_relaxed);
+        read_latency_ns.fetch_add(nanoseconds, memory_order_relaxed);
+    }
+
+    size_t current_depth() const {
+        return depth_limit.load(memory_order_relaxed);
+    }
+
+    // Wait until one more file may run under the current thread count
+    void enter_job() {
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [&] { return running_jobs < jobs_limit; });
+        ++running_jobs;
+    }
+
+    void leave_job() {
+        {
+            lock_guard<mutex> lock(mtx);
+            --running_jobs;
+        }
+        changed.notify_all();
+    }
+
+private:
+    void run() {
+        const auto interval = chrono::milliseconds(500);
+        uint64_t last_frames = 0, last_latency = 0;
+        double base_latency = 0;
+        bool pending = false, tuning_jobs = max_jobs > 1;
+        int plateaus = 0;
+        unsigned previous_jobs = 1;
+        size_t previous_depth = 1;
+
+        unique_lock<mutex> lock(mtx);
+        while (!changed.wait_for(lock, interval, [&] { return stopping; })) {
+            uint64_t frames = frames_read.load(memory_order_relaxed);
+            uint64_t latency = read_latency_ns.load(memory_order_relaxed);
+            if (frames == last_frames) continue;
+
+            double rate = (frames - last_frames) / chrono::duration<double>(interval).count();
+            double avg_latency = double(latency - last_latency) / (frames - last_frames);
+            last_frames = frames;
+            last_latency = latency;
+            if (base_latency == 0) base_latency = avg_latency;
+
+            if (pending) {
+                pending = false;
+                bool improved = rate > best_rate * 1.05;
+                bool spiked = avg_latency > base_latency * 4;
+                if (improved && !spiked) {
+                    plateaus = 0;
+                } else {
+                    jobs_limit = previous_jobs;
+                    depth_limit = previous_depth;
+                    tuning_jobs = !tuning_jobs && max_jobs > 1;
+                    ++plateaus;
+                    if (debug) {
+                        cerr << "Auto-tune: backing off to -j " << jobs_limit << " --depth " << depth_limit
+                             << (spiked ? " (latency spike)" : " (plateau)") << endl;
+                    }
+                    continue;
+                }
+            }
+            best_rate = max(best_rate, rate);
+            if (plateaus >= 2) continue; // Both knobs have plateaued; hold the current settings
+
+            previous_jobs = jobs_limit;
+            previous_depth = depth_limit;
+            if (tuning_jobs && jobs_limit < max_jobs) {
+                jobs_limit = jobs_limit + 1;
+            } else if (depth_limit < max_depth) {
+                depth_limit = min(max_depth, depth_limit * 2);
+            } else {
+                ++plateaus;
+                continue;
+            }
+            pending = true;
+            if (debug) {
+                cerr << "Auto-tune: " << fixed << setprecision(1) << rate << " frames/s, "
+                     << avg_latency / 1e6 << " ms/read; trying -j " << jobs_limit
+                     << " --depth " << depth_limit << endl;
+            }
+            lock.unlock();
+            changed.notify_all();
+            lock.lock();
+        }
     }
+
+    const unsigned max_jobs;
+    const size_t max_depth;
+    atomic<uint64_t> frames_read{0};
+    atomic<uint64_t> read_latency_ns{0};
+    atomic<unsigned> jobs_limit{1};
+    atomic<size_t> depth_limit{1};
+    unsigned running_jobs = 0;
+    double best_rate = 0;
+    bool stopping = false;
+    mutex mtx;
+    condition_variable changed;
+    thread controller;
 };
 
-struct IntValue : public Value {
-    uint32_t value;
-    explicit IntValue(uint32_t val) : value(val) {}
-    void print() const override {
-        cout << value;
+ConcurrencyTuner *tuner = nullptr;
+
+// Runtime adjustment requests from SIGUSR1 (halve the caps) and SIGUSR2 (double them)
+volatile sig_atomic_t rate_signal = 0;
+
+void handle_rate_signal(int signum) {
+    rate_signal = signum;
+}
+
+// Token buckets for bytes and read operations, shared by every reader thread.
+// Each bucket holds at most one second of allowance, so idle periods don't turn into bursts.
+class RateLimiter {
+public:
+    RateLimiter(double bytes_per_sec, double ops_per_sec)
+            : bytes_rate(bytes_per_sec), ops_rate(ops_per_sec),
+              bytes_tokens(bytes_per_sec), ops_tokens(ops_per_sec), last(chrono::steady_clock::now()) {}
+
+    // Block until a read of the given size is allowed
+    void acquire(size_t bytes) {
+        unique_lock<mutex> lock(mtx);
+        while (true) {
+            apply_signal();
+            refill();
+            // A single read larger than a second's allowance only has to wait for a full bucket
+            double needed_bytes = bytes_rate > 0 ? min<double>(bytes, bytes_rate) : 0;
+            double needed_ops = ops_rate > 0 ? 1 : 0;
+            double wait = 0;
+            if (bytes_tokens < needed_bytes) wait = max(wait, (needed_bytes - bytes_tokens) / bytes_rate);
+            if (ops_tokens < needed_ops) wait = max(wait, (needed_ops - ops_tokens) / ops_rate);
+            if (wait <= 0) {
+                bytes_tokens -= needed_bytes;
+                ops_tokens -= needed_ops;
+                return;
+            }
+            lock.unlock();
+            this_thread::sleep_for(chrono::duration<double>(min(wait, 0.1)));
+            lock.lock();
+        }
     }
-    uint32_t getValue() const {
-        return value;
+
+private:
+    void refill() {
+        auto now = chrono::steady_clock::now();
+        double elapsed = chrono::duration<double>(now - last).count();
+        last = now;
+        bytes_tokens = min(bytes_rate, bytes_tokens + elapsed * bytes_rate);
+        ops_tokens = min(ops_rate, ops_tokens + elapsed * ops_rate);
+    }
+
+    void apply_signal() {
+        int signum = rate_signal;
+        if (!signum) return;
+        rate_signal = 0;
+        double factor = signum == SIGUSR1 ? 0.5 : 2.0;
+        bytes_rate *= factor;
+        ops_rate *= factor;
+        cerr << "Rate limit now " << bytes_rate / 1e6 << " MB/s, " << ops_rate << " IOPS"
+             << " (0 = unlimited)" << endl;
     }
+
+    mutex mtx;
+    double bytes_rate, ops_rate;
+    double bytes_tokens, ops_tokens;
+    chrono::steady_clock::time_point last;
 };
 
-// A map with string keys and Value* to hold either StringValue or IntValue
-using ValueMap = map<string, shared_ptr<Value>>;
+RateLimiter *rate_limiter = nullptr;
 
+// Function to lower the calling thread's I/O priority to the idle class where supported
+void set_idle_io_priority() {
+#ifdef __linux__
+    const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3, IOPRIO_CLASS_SHIFT = 13;
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0 && debug) {
+        cerr << "Could not set idle I/O priority: " << strerror(errno) << endl;
+    }
+#endif
+}
 
-// Function to parse the 'RIFF' header
-size_t parse_riff_header(ifstream &file) {
-    vector<uint8_t> data = read_chunk(file, 0, 8);
-    string riff_id = read_string(data, 0);
+// Function to parse a sysfs CPU or node list such as "0-3,8-11"
+vector<int> parse_cpu_list(const string &text) {
+    vector<int> ids;
+    stringstream ranges(text);
+    string range;
+    while (getline(ranges, range, ',')) {
+        if (range.empty() || !isdigit(static_cast<unsigned char>(range[0]))) continue;
+        size_t dash = range.find('-');
+        int first = atoi(range.c_str());
+        int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int id = first; id <= last; ++id) ids.push_back(id);
+    }
+    return ids;
+}
 
-    if (riff_id != "RIFF") {
-        cerr << "This is not a valid AVI file." << endl;
-        exit(EXIT_FAILURE);
+// NUMA nodes with CPUs, read from sysfs. Workers are dealt over the nodes round robin; a worker
+// pins itself to its node's CPUs and prefers its memory, and the reader and scan threads it starts
+// inherit both, so a file's frame buffers are allocated and touched on the node that decodes it.
+// With fewer than two nodes there is nothing to place and binding does nothing.
+class NumaTopology {
+public:
+    NumaTopology() {
+#ifdef __linux__
+        ifstream online("/sys/devices/system/node/online");
+        string list;
+        getline(online, list);
+        for (int id : parse_cpu_list(list)) {
+            ifstream cpulist("/sys/devices/system/node/node" + to_string(id) + "/cpulist");
+            string cpus_text;
+            getline(cpulist, cpus_text);
+            vector<int> cpus = parse_cpu_list(cpus_text);
+            if (!cpus.empty()) nodes.push_back({id, move(cpus)});
+        }
+#endif
     }
 
-    size_t offset = 4;
-    uint32_t riff_size = read_int(data, offset);
-    offset += 4;
-    string riff_format = read_string(data, offset);
-    return offset + 4; // Return the next offset after reading the riff header
+    size_t node_count() const { return nodes.size(); }
+
+    // Function to pin the calling thread to the node of the given worker
+    void bind_worker(unsigned worker) const {
+        if (nodes.size() < 2) return;
+        const Node &node = nodes[worker % nodes.size()];
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : node.cpus) {
+            if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0 && debug) {
+            cerr << "Could not pin worker " << worker << " to node " << node.id << ": " << strerror(errno) << endl;
+        }
+
+        // Preferred rather than bound, so a full node falls back to the others instead of failing
+        const int MPOL_PREFERRED = 1;
+        const size_t bits = sizeof(unsigned long) * 8;
+        vector<unsigned long> mask(node.id / bits + 2, 0);
+        mask[node.id / bits] |= 1UL << (node.id % bits);
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits) != 0 && debug) {
+            cerr << "Could not set the memory policy of worker " << worker << ": " << strerror(errno) << endl;
+        }
+#endif
+        if (debug) cerr << "Worker " << worker << " placed on NUMA node " << node.id << endl;
+    }
+
+private:
+    struct Node {
+        int id;
+        vector<int> cpus;
+    };
+    vector<Node> nodes;
+};
+
+// Pipeline stages reported by --stats
+enum Stage { STAGE_READ, STAGE_DECODE, STAGE_COUNT };
+const char *STAGE_NAMES[STAGE_COUNT] = {"read", "decode"};
+
+#ifdef DV2STR_ALLOC_ACCOUNTING
+// Heap allocations counted per stage through the global operator new. A thread is
+// inside a stage only between StageTimer::begin and end; everything else is "other".
+struct AllocCounters {
+    atomic<uint64_t> allocations{0};
+    atomic<uint64_t> bytes{0};
+};
+
+AllocCounters alloc_counters[STAGE_COUNT + 1];
+thread_local int alloc_stage = STAGE_COUNT;
+
+// Scalar and array, sized and unsized forms are all replaced so that every new pairs with a
+// delete from this same malloc/free set (a partial set trips -Wmismatched-new-delete)
+void *counted_alloc(size_t size) {
+    AllocCounters &counters = alloc_counters[alloc_stage];
+    counters.allocations.fetch_add(1, memory_order_relaxed);
+    counters.bytes.fetch_add(size, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw bad_alloc();
+    return p;
 }
 
-// Function to parse the 'idx1' chunk
-vector<ValueMap> parse_idx1(ifstream &file, size_t offset) {
-    file.seekg(offset);
-    vector<uint8_t> chunk_header = read_chunk(file, offset, 8);
-    string chunk_id = read_string(chunk_header, 0);
-    uint32_t chunk_size = read_int(chunk_header, 4);
+void *operator new(size_t size) {
+    return counted_alloc(size);
+}
 
-    if (chunk_id != "idx1") {
-        cerr << "Error: Expected 'idx1' but found " << chunk_id << endl;
-        return {};
+void *operator new[](size_t size) {
+    return counted_alloc(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+// Hardware and software counters sampled per stage, when the kernel allows it
+enum Counter { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, PAGE_FAULTS, COUNTER_COUNT };
+const char *COUNTER_NAMES[COUNTER_COUNT] = {"cycles", "instructions", "LLC-misses", "branch-misses", "page-faults"};
+
+// Counters of the calling thread, enabled only while a stage is running.
+// Each counter is opened on its own so one missing event doesn't disable the others.
+class PerfCounters {
+public:
+    PerfCounters() {
+        fill(begin(fds), end(fds), -1);
+#ifdef __linux__
+        const pair<uint32_t, uint64_t> events[COUNTER_COUNT] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+                {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+        };
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
     }
 
-    // Vector of maps to store the entries
-    vector<ValueMap> idx_entries;
-    size_t num_entries = chunk_size / 16;
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
 
-    for (size_t i = 0; i < num_entries; ++i) {
-        vector<uint8_t> entry = read_chunk(file, offset + 8 + i * 16, 16);
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    void start() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
 
-        string stream_id = read_string(entry, 0);
-        uint32_t stream_offset = read_int(entry, 4);
-        uint32_t size = read_int(entry, 8);
+    void stop() {
+#ifdef __linux__
+        for (int fd : fds) {
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+#endif
+    }
 
-        // Create a map for each entry
-        ValueMap entry_map;
-        entry_map["stream_id"] = make_shared<StringValue>(stream_id);
-        entry_map["offset"] = make_shared<IntValue>(stream_offset);
-        entry_map["size"] = make_shared<IntValue>(size);
+    bool available(int counter) const {
+        return fds[counter] >= 0;
+    }
 
-        idx_entries.push_back(entry_map);
+    uint64_t value(int counter) const {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (fds[counter] < 0 || ::read(fds[counter], &count, sizeof(count)) != sizeof(count)) return 0;
+#endif
+        return count;
     }
 
-    return idx_entries;
-}
+private:
+    int fds[COUNTER_COUNT];
+};
 
-// Main function to parse the AVI file
-vector<vector<int>> parse_avi_file(const string &file_path) {
-    vector<vector<int>> timecodeDates;
-    ifstream file(file_path, ios::binary);
+// HDR-style latency histogram: 32 linear sub-buckets per power of two, so every
+// recorded value keeps about 3% precision from nanoseconds up to hours.
+// Each thread records into its own copy; copies are merged once the thread is done.
+class LatencyHistogram {
+public:
+    void record(uint64_t nanoseconds) {
+        counts[bucket(nanoseconds)]++;
+        total++;
+        max_value = max(max_value, nanoseconds);
+    }
 
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << file_path << endl;
-        exit(EXIT_FAILURE);
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < BUCKETS; ++i) counts[i] += other.counts[i];
+        total += other.total;
+        max_value = max(max_value, other.max_value);
     }
 
-    size_t offset = parse_riff_header(file);
+    // Upper bound of the bucket holding the given quantile (0..1)
+    uint64_t percentile(double quantile) const {
+        if (total == 0) return 0;
+        uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(quantile * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return min(max_value, upper_bound(i));
+        }
+        return max_value;
+    }
 
-    while (true) {
-        vector<uint8_t> chunk_header = read_chunk(file, offset, 8);
-        if (chunk_header.size() < 8) break; // End of file
+    // Number of recorded values not above the given bound
+    uint64_t count_at_most(uint64_t nanoseconds) const {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS && upper_bound(i) <= nanoseconds; ++i) seen += counts[i];
+        return seen;
+    }
 
-        string chunk_id = read_string(chunk_header, 0);
-        uint32_t chunk_size = read_int(chunk_header, 4);
+    uint64_t count() const { return total; }
+    uint64_t maximum() const { return max_value; }
 
-        if (chunk_id == "idx1") {
-            auto idx1_entries = parse_idx1(file, offset + 8);
-            for (const auto &entry : idx1_entries) {
-                string stream_id = entry.at("stream_id").get();
-                size_t stream_offset = entry.at("offset");
-                uint32_t size = entry.at("size");
-
-                if (size == 144000 || size == 120000) { // Check for NTSC or PAL frame size
-                    file.seekg(stream_offset);
-                    vector<uint8_t> data = read_chunk(file, stream_offset, size);
-
-                    auto results = get_dv_recording_time(data, stream_id, stream_offset);
-                    if (!results.empty()) {
-                        bool found = false;
-                        for (const auto &time : timecodeDates) {
-                            if (time == results) {
-                                found = true;
-                                break;
-                            }
-                        }
-                        if (!found) {
-                            timecodeDates.push_back(results);
-                        }
-                    }
-                }
+private:
+    static const size_t SUB_BITS = 5;
+    static const size_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS) return value;
+        size_t exponent = 63 - __builtin_clzll(value);
+        size_t sub = (value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t upper_bound(size_t index) {
+        if (index < SUB_BUCKETS) return index;
+        size_t exponent = index / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t sub = index % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - SUB_BITS)) - 1;
+    }
+
+    array<uint64_t, BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t max_value = 0;
+};
+
+// Totals of one stage on one worker
+struct StageStats {
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t nanoseconds = 0;
+    uint64_t counters[COUNTER_COUNT] = {};
+    bool counters_available[COUNTER_COUNT] = {};
+    LatencyHistogram latency;
+};
+
+// Collects StageStats from every thread and prints them at the end of the run
+class StatsReport {
+public:
+    void merge(Stage stage, unsigned worker, const StageStats &thread_stats) {
+        lock_guard<mutex> lock(mtx);
+        if (entries.size() <= worker) entries.resize(worker + 1);
+        StageStats &total = entries[worker][stage];
+        total.calls += thread_stats.calls;
+        total.bytes += thread_stats.bytes;
+        total.nanoseconds += thread_stats.nanoseconds;
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            total.counters[i] += thread_stats.counters[i];
+            total.counters_available[i] |= thread_stats.counters_available[i];
+        }
+        total.latency.merge(thread_stats.latency);
+    }
+
+    // Totals of one stage across every worker
+    StageStats stage_totals(Stage stage) {
+        lock_guard<mutex> lock(mtx);
+        StageStats total;
+        for (const auto &worker : entries) add(total, worker[stage]);
+        return total;
+    }
+
+    void print(double elapsed_seconds) {
+        lock_guard<mutex> lock(mtx);
+        cerr << "Stats (" << fixed << setprecision(3) << elapsed_seconds << " s wall):" << endl;
+        cerr << left << setw(8) << "stage" << setw(8) << "worker" << right << setw(10) << "frames"
+             << setw(14) << "MB" << setw(12) << "time_ms";
+        for (auto name : COUNTER_NAMES) cerr << setw(15) << name;
+        cerr << setw(8) << "IPC" << endl;
+
+        bool missing_counters = false;
+        vector<StageStats> totals(STAGE_COUNT);
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            for (unsigned worker = 0; worker < entries.size(); ++worker) {
+                print_row(STAGE_NAMES[stage], to_string(worker), entries[worker][stage], missing_counters);
+                add(totals[stage], entries[worker][stage]);
             }
-            break;
+            if (entries.size() > 1) print_row(STAGE_NAMES[stage], "all", totals[stage], missing_counters);
+        }
+        if (missing_counters) {
+            cerr << "- = counter unavailable (perf_event_open denied or unsupported)" << endl;
         }
 
-        offset += chunk_size + 8;
+        cerr << "Per-frame latency (ms):" << endl;
+        cerr << left << setw(8) << "stage" << right << setw(10) << "p50" << setw(10) << "p99"
+             << setw(10) << "p99.9" << setw(10) << "max" << endl;
+        for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+            const LatencyHistogram &latency = totals[stage].latency;
+            cerr << left << setw(8) << STAGE_NAMES[stage] << right << setprecision(3)
+                 << setw(10) << latency.percentile(0.50) / 1e6 << setw(10) << latency.percentile(0.99) / 1e6
+                 << setw(10) << latency.percentile(0.999) / 1e6 << setw(10) << latency.maximum() / 1e6 << endl;
+        }
     }
 
-    return timecodeDates;
+private:
+    static void add(StageStats &total, const StageStats &s) {
+        total.calls += s.calls;
+        total.bytes += s.bytes;
+        total.nanoseconds += s.nanoseconds;
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            total.counters[i] += s.counters[i];
+            total.counters_available[i] |= s.counters_available[i];
+        }
+        total.latency.merge(s.latency);
+    }
+
+    static void print_row(const string &stage, const string &worker, const StageStats &s, bool &missing_counters) {
+        cerr << left << setw(8) << stage << setw(8) << worker << right << setw(10) << s.calls
+             << setw(14) << setprecision(1) << s.bytes / 1e6 << setw(12) << s.nanoseconds / 1e6;
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            if (s.counters_available[i]) {
+                cerr << setw(15) << s.counters[i];
+            } else {
+                cerr << setw(15) << "-";
+                missing_counters = true;
+            }
+        }
+        if (s.counters_available[CYCLES] && s.counters_available[INSTRUCTIONS] && s.counters[CYCLES]) {
+            cerr << setw(8) << setprecision(2) << double(s.counters[INSTRUCTIONS]) / s.counters[CYCLES];
+        } else {
+            cerr << setw(8) << "-";
+        }
+        cerr << endl;
+    }
+
+    mutex mtx;
+    vector<array<StageStats, STAGE_COUNT>> entries;
+};
+
+StatsReport *stats_report = nullptr;
+
+// Per-thread timer for one stage; merges into the report when the thread is done with it
+class StageTimer {
+public:
+    StageTimer(Stage stage, unsigned worker) : stage(stage), worker(worker) {
+        if (!stats_report) return;
+        counters = make_unique<PerfCounters>();
+        for (int i = 0; i < COUNTER_COUNT; ++i) totals.counters_available[i] = counters->available(i);
+    }
+
+    ~StageTimer() {
+        if (!stats_report) return;
+        for (int i = 0; i < COUNTER_COUNT; ++i) totals.counters[i] = counters->value(i);
+        stats_report->merge(stage, worker, totals);
+    }
+
+    void begin() {
+#ifdef DV2STR_ALLOC_ACCOUNTING
+        alloc_stage = stage;
+#endif
+        if (!stats_report) return;
+        counters->start();
+        started = chrono::steady_clock::now();
+    }
+
+    void end(size_t bytes) {
+#ifdef DV2STR_ALLOC_ACCOUNTING
+        alloc_stage = STAGE_COUNT;
+#endif
+        if (!stats_report) return;
+        uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+        counters->stop();
+        totals.nanoseconds += elapsed;
+        totals.latency.record(elapsed);
+        totals.calls++;
+        totals.bytes += bytes;
+    }
+
+private:
+    Stage stage;
+    unsigned worker;
+    unique_ptr<PerfCounters> counters;
+    StageStats totals;
+    chrono::steady_clock::time_point started;
+};
+
+// Work done so far, bumped by the decoders with relaxed atomics and read by the progress thread.
+// Each counter has its own cache line so the reporter's reads never slow down the writers.
+struct ProgressCounters {
+    alignas(64) atomic<uint64_t> frames{0};
+    alignas(64) atomic<uint64_t> bytes{0};
+    // Frames found by the movi scan of files without idx1, which the reporter's totals can't include
+    alignas(64) atomic<uint64_t> scanned_frames{0};
+    alignas(64) atomic<uint64_t> scanned_bytes{0};
+    // Frames of files answered from their embedded index, which the totals drop instead
+    alignas(64) atomic<uint64_t> skipped_frames{0};
+    alignas(64) atomic<uint64_t> skipped_bytes{0};
+};
+
+ProgressCounters progress;
+
+// Outcome counters exported as Prometheus metrics
+struct RunCounters {
+    atomic<uint64_t> files_ok{0};
+    atomic<uint64_t> files_failed{0};
+    atomic<uint64_t> frames_rejected{0};
+    atomic<uint64_t> read_errors{0};
+};
+
+RunCounters run_counters;
+
+// Priority classes of the lookup service's decode jobs, most urgent first
+enum Priority { PRIORITY_INTERACTIVE, PRIORITY_NORMAL, PRIORITY_BULK, PRIORITY_COUNT };
+const char *const PRIORITY_NAMES[PRIORITY_COUNT] = {"interactive", "normal", "bulk"};
+
+// Frames decoded between two chances for a more urgent job to take over the slot
+const size_t FRAME_BATCH = 16;
+
+// One decode job's place in the scheduler
+struct SchedulerTicket {
+    Priority priority = PRIORITY_NORMAL;
+    string client;
+    bool granted = false;
+    uint64_t frames = 0;
+    chrono::steady_clock::time_point queued_at;
+};
+
+// Decode slots (one thread each) handed out by priority class, and round robin between the clients
+// of a class. A running job gives its slot up at a frame-batch boundary when a more urgent job,
+// or another client of its own class, is waiting, and queues again behind it.
+class DecodeScheduler {
+public:
+    explicit DecodeScheduler(size_t slots) : free_slots(max<size_t>(1, slots)) {}
+
+    struct ClassSnapshot {
+        size_t queued = 0, running = 0;
+        uint64_t preemptions = 0;
+        uint64_t wait_nanoseconds = 0;
+        LatencyHistogram wait;
+    };
+
+    // Blocks until the job holds a slot
+    void acquire(SchedulerTicket &ticket) {
+        unique_lock<mutex> lock(mtx);
+        enqueue(ticket);
+        dispatch();
+        granted.wait(lock, [&] { return ticket.granted; });
+    }
+
+    void release(SchedulerTicket &ticket) {
+        lock_guard<mutex> lock(mtx);
+        give_back(ticket);
+        dispatch();
+    }
+
+    // Called at frame-batch boundaries by the job holding a slot
+    void checkpoint(SchedulerTicket &ticket) {
+        unique_lock<mutex> lock(mtx);
+        if (!should_yield(ticket)) return;
+        classes[ticket.priority].preemptions++;
+        give_back(ticket);
+        enqueue(ticket);
+        dispatch();
+        granted.wait(lock, [&] { return ticket.granted; });
+    }
+
+    array<ClassSnapshot, PRIORITY_COUNT> snapshot() {
+        lock_guard<mutex> lock(mtx);
+        array<ClassSnapshot, PRIORITY_COUNT> result;
+        for (size_t i = 0; i < PRIORITY_COUNT; ++i) {
+            result[i] = classes[i];
+            result[i].queued = 0;
+            for (const auto &client : waiting[i]) result[i].queued += client.second.size();
+        }
+        return result;
+    }
+
+private:
+    void enqueue(SchedulerTicket &ticket) {
+        ticket.queued_at = chrono::steady_clock::now();
+        auto &clients = waiting[ticket.priority];
+        if (clients[ticket.client].empty()) rotation[ticket.priority].push_back(ticket.client);
+        clients[ticket.client].push_back(&ticket);
+    }
+
+    void give_back(SchedulerTicket &ticket) {
+        ticket.granted = false;
+        classes[ticket.priority].running--;
+        free_slots++;
+    }
+
+    bool should_yield(const SchedulerTicket &ticket) const {
+        for (int priority = 0; priority <= ticket.priority; ++priority) {
+            for (const auto &client : waiting[priority]) {
+                if (!client.second.empty() && (priority < ticket.priority || client.first != ticket.client)) return true;
+            }
+        }
+        return false;
+    }
+
+    // Grants free slots to the most urgent class, taking its clients in turn
+    void dispatch() {
+        bool woke = false;
+        for (int priority = 0; priority < PRIORITY_COUNT && free_slots; ++priority) {
+            auto &order = rotation[priority];
+            while (!order.empty() && free_slots) {
+                string client = order.front();
+                order.pop_front();
+                auto &queue = waiting[priority][client];
+                SchedulerTicket *ticket = queue.front();
+                queue.pop_front();
+                if (queue.empty()) {
+                    waiting[priority].erase(client);
+                } else {
+                    order.push_back(client);
+                }
+
+                uint64_t waited = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - ticket->queued_at).count();
+                classes[priority].wait.record(waited);
+                classes[priority].wait_nanoseconds += waited;
+                classes[priority].running++;
+                ticket->granted = true;
+                free_slots--;
+                woke = true;
+            }
+        }
+        if (woke) granted.notify_all();
+    }
+
+    mutex mtx;
+    condition_variable granted;
+    size_t free_slots;
+    array<deque<string>, PRIORITY_COUNT> rotation;
+    array<map<string, deque<SchedulerTicket*>>, PRIORITY_COUNT> waiting;
+    array<ClassSnapshot, PRIORITY_COUNT> classes;
+};
+
+DecodeScheduler *decode_scheduler = nullptr;
+thread_local SchedulerTicket *scheduler_ticket = nullptr; // Job the calling thread decodes for
+
+// Function to call after each decoded frame; every FRAME_BATCH frames a more urgent job may take over
+inline void scheduler_checkpoint() {
+    if (decode_scheduler && scheduler_ticket && ++scheduler_ticket->frames % FRAME_BATCH == 0) {
+        decode_scheduler->checkpoint(*scheduler_ticket);
+    }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        cerr << "dv2str <video_file_path> <-debug>" << endl;
-        return 1;
+// Holds a decode slot for the calling thread's job while in scope; a no-op outside the lookup service
+struct ScheduledDecode {
+    ScheduledDecode() {
+        if (decode_scheduler && scheduler_ticket) decode_scheduler->acquire(*scheduler_ticket);
     }
+    ~ScheduledDecode() {
+        if (decode_scheduler && scheduler_ticket) decode_scheduler->release(*scheduler_ticket);
+    }
+};
 
-    debug = (argc == 3);
+// A frame read from the file, waiting in the prefetch queue to be decoded
+struct Frame {
+    vector<uint8_t> *buffer = nullptr; // nullptr marks the end of the stream
+    string stream_id;
+    uint32_t offset = 0;
+};
 
-    string file_path = argv[1];
-    auto timecodes = parse_avi_file(file_path);
+// Fixed set of frame buffers; the reader blocks when every buffer is in flight
+class FramePool {
+public:
+    explicit FramePool(size_t count) : storage(count) {
+        for (auto &buffer : storage) {
+            buffer.reserve(MAX_FRAME_SIZE);
+            free_list.push_back(&buffer);
+        }
+    }
 
-    // Print timecodes
-    for (const auto &timecode : timecodes) {
-        cout << "Timecode: ";
-        for (int part : timecode) {
-            cout << part << " ";
+    vector<uint8_t> *acquire() {
+        unique_lock<mutex> lock(mtx);
+        if (tuner) {
+            // The tuner may lower the depth below the pool size at any time, so poll for it
+            while (!returned.wait_for(lock, chrono::milliseconds(20), [&] {
+                return !free_list.empty() && in_use < tuner->current_depth();
+            })) {}
+        } else {
+            returned.wait(lock, [&] { return !free_list.empty(); });
+        }
+        auto buffer = free_list.back();
+        free_list.pop_back();
+        ++in_use;
+        return buffer;
+    }
+
+    void release(vector<uint8_t> *buffer) {
+        {
+            lock_guard<mutex> lock(mtx);
+            free_list.push_back(buffer);
+            --in_use;
+        }
+        returned.notify_one();
+    }
+
+private:
+    mutex mtx;
+    condition_variable returned;
+    deque<vector<uint8_t>> storage;
+    vector<vector<uint8_t> *> free_list;
+    size_t in_use = 0;
+};
+
+// Bounded queue between the reader and decoder of a file
+class FrameQueue {
+public:
+    void push(Frame frame) {
+        {
+            lock_guard<mutex> lock(mtx);
+            frames.push_back(std::move(frame));
         }
-        cout << endl;
+        ready.notify_one();
+    }
+
+    Frame pop() {
+        unique_lock<mutex> lock(mtx);
+        ready.wait(lock, [&] { return !frames.empty(); });
+        Frame frame = std::move(frames.front());
+        frames.pop_front();
+        return frame;
+    }
+
+private:
+    mutex mtx;
+    condition_variable ready;
+    deque<Frame> frames;
+};
+
+// Function to parse the 'RIFF' header
+size_t parse_riff_header(ifstream &file) {
+    vector<uint8_t> data = read_chunk(file, 0, 12);
+
+    if (data.size() < 12 || read_string(data, 0) != "RIFF") {
+        cerr << "This is not a valid AVI file." << endl;
+        return 0;
+    }
+
+    size_t offset = 4;
+    uint32_t riff_size = read_int(data, offset);
+    offset += 4;
+    string riff_format = read_string(data, offset);
+    if (debug) {
+        cerr << "RIFF size: " << riff_size << ", format: " << riff_format << endl;
+    }
+    return offset + 4; // Return the next offset after reading the riff header
+}
+
+// Function to read a window of 'idx1' entries, starting at entry first
+vector<IndexEntry> parse_idx1(ifstream &file, size_t offset, size_t first, size_t count) {
+    vector<IndexEntry> idx_entries(count);
+    file.seekg(offset + first * IDX1_ENTRY_SIZE);
+    file.read(reinterpret_cast<char*>(idx_entries.data()), count * IDX1_ENTRY_SIZE);
+    idx_entries.resize(file.gcount() / IDX1_ENTRY_SIZE);
+    return idx_entries;
+}
+
+// Function to tell whether four bytes are a FOURCC the walker can resynchronize on:
+// stream chunks of streams 00-09 (##dc, ##db, ##wb), LIST, JUNK, idx1 and OpenDML ix## indexes
+bool is_known_fourcc(const uint8_t *p) {
+    if (p[0] == '0' && isdigit(p[1])) {
+        return (p[2] == 'd' && (p[3] == 'c' || p[3] == 'b')) || (p[2] == 'w' && p[3] == 'b');
+    }
+    if (p[0] == 'i') {
+        return memcmp(p, "idx1", 4) == 0 || (p[1] == 'x' && isdigit(p[2]) && isdigit(p[3]));
     }
+    return memcmp(p, "LIST", 4) == 0 || memcmp(p, "JUNK", 4) == 0;
+}
+
+// Function to check a resynchronization candidate: a known FOURCC whose size fits in the file
+bool is_chunk_candidate(const uint8_t *p, uint64_t offset, uint64_t file_size) {
+    if (!is_known_fourcc(p)) return false;
+    uint64_t size = p[4] | (p[5] << 8) | (p[6] << 16) | (uint64_t(p[7]) << 24);
+    return offset + 8 + size <= file_size;
+}
+
+// Holes skipped in sparse files, reported by --stats and the metrics
+atomic<uint64_t> sparse_skipped_extents{0};
+atomic<uint64_t> sparse_skipped_bytes{0};
 
-    return 0;
-}
\ No newline at end of file
+// Data/hole layout of a possibly sparse file, queried with SEEK_DATA so scans can jump
+// over holes instead of reading zeros. Without SEEK_DATA support every offset counts as data.
+class SparseFile {
+public:
+    explicit SparseFile(const string &path) {
+#ifdef SEEK_DATA
+        fd = open(path.c_str(), O_RDONLY);
+#endif
+    }
+
+    ~SparseFile() {
+#ifdef SEEK_DATA
+        if (fd >= 0) close(fd);
+#endif
+    }
+
+    SparseFile(const SparseFile &) = delete;
+    SparseFile &operator=(const SparseFile &) = delete;
+
+    // Returns offset if it holds data, otherwise the start of the next data extent (end if none)
+    uint64_t next_data(uint64_t offset, uint64_t end) {
+#ifdef SEEK_DATA
+        if (fd < 0 || offset >= end) return offset;
+        off_t data = lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+        if (data < 0) {
+            if (errno != ENXIO) return offset; // Unsupported here; treat everything as data
+            data = static_cast<off_t>(end);    // Only a hole is left
+        }
+        uint64_t next = min<uint64_t>(data, end);
+        if (next > offset) {
+            count_hole(data, offset, next);
+            if (debug) cerr << "Skipping hole " << offset << "-" << next << endl;
+        }
+        return next;
+#else
+        return offset;
+#endif
+    }
+
+private:
+    // Parallel scan ranges meet holes in any order and may each skip part of one, so holes are
+    // keyed by the data offset that ends them and only the growth of the skipped span is counted
+    void count_hole(uint64_t data, uint64_t from, uint64_t to) {
+        lock_guard<mutex> lock(holes_mtx);
+        auto found = holes.find(data);
+        if (found == holes.end()) {
+            holes.emplace(data, make_pair(from, to));
+            sparse_skipped_extents.fetch_add(1, memory_order_relaxed);
+            sparse_skipped_bytes.fetch_add(to - from, memory_order_relaxed);
+            return;
+        }
+        auto &span = found->second;
+        uint64_t before = span.second - span.first;
+        span.first = min(span.first, from);
+        span.second = max(span.second, to);
+        sparse_skipped_bytes.fetch_add(span.second - span.first - before, memory_order_relaxed);
+    }
+
+    int fd = -1;
+    mutex holes_mtx;
+    map<uint64_t, pair<uint64_t, uint64_t>> holes; // Data offset ending the hole -> skipped span
+};
+
+// Function to scan forward from offset for the next chunk header the walker can trust.
+// SSE2 compares 16 bytes at a time against the possible first bytes ('0', 'L', 'J', 'i'),
+// so only a few positions per block go through the full check. Returns file_size if none.
+// With a SparseFile, holes are skipped without being read.
+uint64_t find_chunk_signature(ifstream &file, uint64_t offset, uint64_t file_size, SparseFile *sparse = nullptr) {
+    const size_t BLOCK = 1 << 20;
+    while (offset + 8 <= file_size) {
+        if (sparse) {
+            offset = sparse->next_data(offset, file_size);
+            if (offset + 8 > file_size) break;
+        }
+        vector<uint8_t> block = read_chunk(file, offset, min<uint64_t>(BLOCK + 7, file_size - offset));
+        file.clear();
+        size_t limit = block.size() >= 8 ? block.size() - 7 : 0; // Positions with a whole header
+        const uint8_t *data = block.data();
+        size_t i = 0;
+#ifdef __SSE2__
+        const __m128i zero = _mm_set1_epi8('0'), list = _mm_set1_epi8('L'), junk = _mm_set1_epi8('J'),
+                index = _mm_set1_epi8('i');
+        for (; i + 16 <= limit; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, zero), _mm_cmpeq_epi8(bytes, list)),
+                                        _mm_or_si128(_mm_cmpeq_epi8(bytes, junk), _mm_cmpeq_epi8(bytes, index)));
+            for (int mask = _mm_movemask_epi8(hits); mask; mask &= mask - 1) {
+                size_t position = i + __builtin_ctz(mask);
+                if (is_chunk_candidate(data + position, offset + position, file_size)) return offset + position;
+            }
+        }
+#endif
+        for (; i < limit; ++i) {
+            if (is_chunk_candidate(data + i, offset + i, file_size)) return offset + i;
+        }
+        if (block.size() < BLOCK + 7) break;
+        offset += BLOCK;
+    }
+    return file_size;
+}
+
+// Walks sibling chunks from a starting offset. A header with a non-printable FOURCC or a
+// size running past the end of the file means the previous size was wrong (or this one is),
+// so the walker scans forward for the next recognizable chunk header instead of giving up.
+class ChunkWalker {
+public:
+    ChunkWalker(ifstream &file, uint64_t offset) : file(file), offset(offset), resync_from(offset + 1) {
+        file.clear();
+        file.seekg(0, ios::end);
+        file_size = file.tellg();
+    }
+
+    // Reads the next chunk header; false at the end of the file or when nothing valid is left
+    bool next(string &chunk_id, uint64_t &chunk_size, uint64_t &chunk_offset, string &list_type) {
+        while (offset + 8 <= file_size) {
+            vector<uint8_t> header = read_chunk(file, offset, 12);
+            file.clear();
+            if (header.size() < 8) return false;
+
+            chunk_id = read_string(header, 0);
+            chunk_size = read_int(header, 4);
+            list_type = header.size() == 12 ? read_string(header, 8) : "";
+            if (!plausible(chunk_id, chunk_size, list_type)) {
+                // Rescan from inside the previous chunk, unless that already led back to this same header
+                uint64_t start = offset == last_failure ? offset + 1 : resync_from;
+                last_failure = offset;
+                uint64_t found = find_chunk_signature(file, start, file_size);
+                if (debug) {
+                    cerr << "Implausible chunk header at " << offset << ", resynchronized at " << found << endl;
+                }
+                resyncs++;
+                offset = found;
+                continue;
+            }
+
+            // A truncated capture's 'movi' list runs past the end of the file; keep what is there
+            if (offset + 8 + chunk_size > file_size) {
+                if (debug) cerr << "'movi' list at " << offset << " is truncated to the end of the file" << endl;
+                chunk_size = file_size - offset - 8;
+            }
+
+            chunk_offset = offset;
+            resync_from = offset + 8; // A bad next header is searched for from inside this chunk
+            offset += 8 + chunk_size + (chunk_size & 1);
+            return true;
+        }
+        return false;
+    }
+
+    size_t resync_count() const { return resyncs; }
+
+private:
+    // Sizes must fit in the file, except for a 'movi' list, which overruns it in truncated captures
+    bool plausible(const string &chunk_id, uint64_t chunk_size, const string &list_type) const {
+        for (char c : chunk_id) {
+            if (c < 32 || c > 126) return false;
+        }
+        if (chunk_id == "LIST" && list_type == "movi") return true;
+        return offset + 8 + chunk_size <= file_size;
+    }
+
+    ifstream &file;
+    uint64_t offset;
+    uint64_t resync_from;
+    uint64_t last_failure = 0;
+    uint64_t file_size = 0;
+    size_t resyncs = 0;
+};
+
+// Function to locate the 'idx1' chunk; returns the offset of its entries and their count
+bool find_idx1(ifstream &file, size_t offset, size_t &entries_offset, size_t &num_entries) {
+    ChunkWalker walker(file, offset);
+    string chunk_id, list_type;
+    uint64_t chunk_size = 0, chunk_offset = 0;
+
+    while (walker.next(chunk_id, chunk_size, chunk_offset, list_type)) {
+        if (chunk_id == "idx1") {
+            entries_offset = chunk_offset + 8;
+            num_entries = chunk_size / IDX1_ENTRY_SIZE;
+            return true;
+        }
+    }
+    return false; // End of file
+}
+
+// Function to tell what idx1 offsets count from: the file start (absolute) or the 'movi' FOURCC,
+// decided by whether the chunk header at the probe entry's offset carries its stream id
+uint64_t idx1_base(ifstream &file, const IndexEntry &probe, uint64_t movi_start) {
+    vector<uint8_t> header = read_chunk(file, probe.offset, 4);
+    file.clear();
+    bool absolute = header.size() == 4 && memcmp(header.data(), probe.stream_id, 4) == 0;
+    return absolute ? 0 : movi_start;
+}
+
+// Reader side of the pipeline: walks idx1 in budgeted windows and prefetches DV frames
+void read_frames(const string &file_path, size_t entries_offset, size_t num_entries, uint64_t base,
+                 size_t window, FramePool &pool, FrameQueue &queue, unsigned worker) {
+    if (background) set_idle_io_priority();
+    StageTimer timer(STAGE_READ, worker);
+    ifstream file(file_path, ios::binary);
+
+    for (size_t first = 0; first < num_entries && file; first += window) {
+        if (rate_limiter) rate_limiter->acquire(min(window, num_entries - first) * IDX1_ENTRY_SIZE);
+        auto entries = parse_idx1(file, entries_offset, first, min(window, num_entries - first));
+        file.clear();
+
+        for (const auto &entry : entries) {
+            if (entry.size != 144000 && entry.size != 120000) continue; // Check for NTSC or PAL frame size
+
+            Frame frame;
+            frame.buffer = pool.acquire();
+            if (rate_limiter) rate_limiter->acquire(entry.size);
+            frame.stream_id = string(entry.stream_id, 4);
+            frame.offset = entry.offset;
+
+            auto started = chrono::steady_clock::now();
+            timer.begin();
+            frame.buffer->resize(entry.size);
+            file.seekg(base + entry.offset + 8); // Payload after the chunk header
+            file.read(reinterpret_cast<char*>(frame.buffer->data()), entry.size);
+            frame.buffer->resize(file.gcount());
+            if (frame.buffer->size() != entry.size) run_counters.read_errors.fetch_add(1, memory_order_relaxed);
+            file.clear();
+            timer.end(frame.buffer->size());
+            if (tuner) {
+                tuner->record_read(chrono::duration_cast<chrono::nanoseconds>(
+                        chrono::steady_clock::now() - started).count());
+            }
+
+            queue.push(std::move(frame));
+        }
+    }
+
+    queue.push(Frame{}); // End of stream
+}
+
+// Function to locate the top-level 'movi' LIST; start is the offset of its 'movi' FOURCC
+bool find_movi(ifstream &file, size_t offset, uint64_t &movi_start, uint64_t &movi_end) {
+    ChunkWalker walker(file, offset);
+    string chunk_id, list_type;
+    uint64_t chunk_size = 0, chunk_offset = 0;
+
+    while (walker.next(chunk_id, chunk_size, chunk_offset, list_type)) {
+        if (chunk_id == "LIST" && list_type == "movi") {
+            movi_start = chunk_offset + 8;
+            movi_end = chunk_offset + 8 + chunk_size;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to add a timecode to the list unless it is already there
+void add_timecode(vector<Timecode> &timecodeDates, const Timecode &results) {
+    bool found = false;
+    for (const auto &time : timecodeDates) {
+        if (time == results) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        timecodeDates.push_back(results);
+    }
+}
+
+// Function to find a chunk header to start scanning at. A single FOURCC match inside DV
+// data is not unlikely, so the chunk that follows it must be a known header (or the end) too.
+uint64_t find_scan_start(ifstream &file, uint64_t offset, uint64_t movi_end, SparseFile *sparse) {
+    while (true) {
+        uint64_t candidate = find_chunk_signature(file, offset, movi_end, sparse);
+        if (candidate >= movi_end) return movi_end;
+
+        vector<uint8_t> header = read_chunk(file, candidate, 8);
+        file.clear();
+        uint64_t size = read_int(header, 4);
+        uint64_t next = candidate + 8 + size + (size & 1);
+        if (read_string(header, 0) == "LIST") next = candidate + 12; // Lists are entered, not skipped
+        if (next >= movi_end) return candidate;
+
+        vector<uint8_t> following = read_chunk(file, next, 8);
+        file.clear();
+        if (following.size() == 8 && is_chunk_candidate(following.data(), next, movi_end)) return candidate;
+        offset = candidate + 1;
+    }
+}
+
+// Chunks walked by one scan thread
+struct ScanRange {
+    uint64_t start = 0, end = 0; // Chunks starting in [start, end) belong to this range
+    uint64_t stop = 0;           // First chunk at or past end, where the next range should have started
+    vector<uint64_t> chunks;     // Offset of every chunk walked, in file order
+    vector<pair<uint64_t, optional<Timecode>>> timecodes; // Every DV frame, empty if rejected
+};
+
+// Function to walk 'movi' chunks from offset, decoding DV frames, until a chunk starts at or
+// past limit (or, when sync is given, until reaching a chunk offset listed in it)
+void scan_chunks(ifstream &file, uint64_t offset, uint64_t limit, uint64_t movi_end, ScanRange &range,
+                 vector<uint8_t> &buffer, StageTimer &read_timer, StageTimer &decode_timer,
+                 SparseFile *sparse, const vector<uint64_t> *sync = nullptr) {
+    while (offset + 8 <= movi_end && offset < limit) {
+        if (sync && binary_search(sync->begin(), sync->end(), offset)) break;
+
+        vector<uint8_t> header = read_chunk(file, offset, 12);
+        file.clear();
+        if (header.size() < 8) break;
+
+        string chunk_id = read_string(header, 0);
+        uint64_t chunk_size = read_int(header, 4);
+        bool printable = all_of(chunk_id.begin(), chunk_id.end(), [](char c) { return c >= 32 && c <= 126; });
+        if (!printable || offset + 8 + chunk_size > movi_end) {
+            offset = find_scan_start(file, offset + 1, movi_end, sparse);
+            continue;
+        }
+        range.chunks.push_back(offset);
+
+        if (chunk_id == "LIST") { // 'rec ' lists group the chunks of one frame
+            offset += 12;
+            continue;
+        }
+
+        if ((chunk_size == 144000 || chunk_size == 120000) && chunk_id[2] == 'd') {
+            // Frame reads are capped and measured like those of read_frames
+            if (rate_limiter) rate_limiter->acquire(chunk_size);
+            auto started = chrono::steady_clock::now();
+            read_timer.begin();
+            buffer.resize(chunk_size);
+            file.seekg(offset + 8);
+            file.read(reinterpret_cast<char*>(buffer.data()), chunk_size);
+            buffer.resize(file.gcount());
+            file.clear();
+            read_timer.end(buffer.size());
+            if (tuner) {
+                tuner->record_read(chrono::duration_cast<chrono::nanoseconds>(
+                        chrono::steady_clock::now() - started).count());
+            }
+
+            decode_timer.begin();
+            auto results = get_dv_recording_time(buffer, chunk_id, offset);
+            decode_timer.end(buffer.size());
+            scheduler_checkpoint();
+            if (progress_mode != PROGRESS_OFF || stats_report) {
+                progress.frames.fetch_add(1, memory_order_relaxed);
+                progress.bytes.fetch_add(buffer.size(), memory_order_relaxed);
+                progress.scanned_frames.fetch_add(1, memory_order_relaxed);
+                progress.scanned_bytes.fetch_add(buffer.size(), memory_order_relaxed);
+                if (!results) run_counters.frames_rejected.fetch_add(1, memory_order_relaxed);
+            }
+            range.timecodes.emplace_back(offset, results);
+        }
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+    range.stop = offset;
+}
+
+// Consecutive frames sharing a timecode, as stored in the embedded 'dvtc' index
+struct TimecodeSegment {
+    Timecode timecode;
+    uint64_t first_offset; // Chunk offset of the segment's first frame
+    uint32_t frames;
+};
+
+// Per-frame result written by --frames-file, in host byte order. The layout is mirrored by
+// FRAME_RECORD_DTYPE in main.py; change both together.
+struct FrameRecord {
+    uint32_t file;     // Index of the file in the run's output order
+    uint32_t frame;    // Index of the DV frame within the file
+    uint64_t offset;   // Chunk offset of the frame
+    int64_t timestamp; // Recording time in seconds since 1970-01-01 (as if UTC); 0 without a valid timecode
+    uint32_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(FrameRecord) == 32, "FrameRecord layout is read by main.py");
+
+const uint32_t FRAME_VALID = 1;   // The frame carried a valid recording time
+const uint32_t FRAME_SCANNED = 2; // Found by the movi scan rather than through idx1
+
+// Header of a --frames-file: the records follow it, then the NUL-terminated paths of the files
+struct FrameFileHeader {
+    char magic[8] = {'D', 'V', '2', 'S', 'T', 'R', 'F', '1'};
+    uint32_t record_size = sizeof(FrameRecord);
+    uint32_t files = 0;
+    uint64_t records = 0;
+    uint64_t paths_offset = 0;
+};
+
+// Function to convert a timecode to seconds since 1970-01-01, taking it as UTC
+int64_t timecode_seconds(const Timecode &t) {
+    // Days from the civil date, counting years from March so the leap day comes last
+    int64_t year = t[2] - (t[1] <= 2);
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (t[1] + (t[1] > 2 ? -3 : 9)) + 2) / 5 + t[0] - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int64_t days = era * 146097 + day_of_era - 719468;
+    return days * 86400 + t[3] * 3600 + t[4] * 60 + t[5];
+}
+
+// Function to append a frame's result, given the frame's index within its file
+void add_frame_record(vector<FrameRecord> *records, uint64_t frame, uint64_t offset,
+                      const optional<Timecode> &timecode, uint32_t flags) {
+    if (!records) return;
+    FrameRecord record{};
+    record.frame = static_cast<uint32_t>(frame);
+    record.offset = offset;
+    if (timecode) {
+        record.timestamp = timecode_seconds(*timecode);
+        flags |= FRAME_VALID;
+    }
+    record.flags = flags;
+    records->push_back(record);
+}
+
+// Function to extend the last segment with a frame, or start a new one when the timecode changes
+void add_segment_frame(vector<TimecodeSegment> &segments, const Timecode &timecode, uint64_t offset) {
+    if (!segments.empty() && segments.back().timecode == timecode) {
+        segments.back().frames++;
+    } else {
+        segments.push_back({timecode, offset, 1});
+    }
+}
+
+// Where the chunks relevant to the embedded index are; offsets are of chunk headers, 0 = absent
+struct IndexLocation {
+    uint64_t index_offset = 0, index_size = 0;
+    uint64_t junk_offset = 0, junk_size = 0; // Largest 'JUNK' padding
+    uint64_t movi_size = 0;                  // Size of the first 'movi' LIST, which the index is valid for
+    uint64_t last_riff = 0, last_riff_end = 0;
+};
+
+// Function to find the 'dvtc', 'JUNK' and 'movi' chunks at the top level of every RIFF and inside
+// 'hdrl'. Only headers are read and 'movi' is not entered, so this costs a handful of reads.
+void locate_index_chunks(ifstream &file, uint64_t start, uint64_t end, IndexLocation &location) {
+    for (uint64_t offset = start; offset + 8 <= end;) {
+        vector<uint8_t> header = read_chunk(file, offset, 12);
+        file.clear();
+        if (header.size() < 8) return;
+        string chunk_id = read_string(header, 0);
+        uint64_t chunk_size = read_int(header, 4);
+        string list_type = header.size() == 12 ? read_string(header, 8) : "";
+        uint64_t chunk_end = offset + 8 + chunk_size;
+        bool truncated = chunk_end > end; // Cut short or damaged: enter what is there, then stop
+
+        if (chunk_id == "RIFF") {
+            location.last_riff = offset;
+            location.last_riff_end = chunk_end;
+            locate_index_chunks(file, offset + 12, min(chunk_end, end), location);
+        } else if (chunk_id == "LIST" && list_type == "hdrl") {
+            locate_index_chunks(file, offset + 12, min(chunk_end, end), location);
+        } else if (chunk_id == "LIST" && list_type == "movi" && !location.movi_size) {
+            location.movi_size = chunk_size;
+        } else if (truncated) {
+            return;
+        } else if (chunk_id == "dvtc" && !location.index_offset) {
+            location.index_offset = offset;
+            location.index_size = chunk_size;
+        } else if (chunk_id == "JUNK" && chunk_size > location.junk_size) {
+            location.junk_offset = offset;
+            location.junk_size = chunk_size;
+        }
+        if (truncated) return;
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+}
+
+// Function to append an integer of the given width, little endian like the rest of RIFF
+void put_int(vector<uint8_t> &data, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+// 'dvtc' payload: version (4), 'movi' size (8), segment count (4), then 24 bytes per segment:
+// day, month, year (2), hour, minute, second, reserved, first chunk offset (8), frames (4), reserved (4)
+const uint32_t TIMECODE_INDEX_VERSION = 1;
+const size_t TIMECODE_INDEX_HEADER = 16;
+const size_t TIMECODE_SEGMENT_SIZE = 24;
+
+// Function to load the embedded index when it matches the file's 'movi'; false means decode the frames
+bool read_timecode_index(ifstream &file, const IndexLocation &location, vector<Timecode> &timecodeDates) {
+    if (!location.index_offset || location.index_size < TIMECODE_INDEX_HEADER) return false;
+    vector<uint8_t> header = read_chunk(file, location.index_offset + 8, TIMECODE_INDEX_HEADER);
+    file.clear();
+    if (header.size() < TIMECODE_INDEX_HEADER || read_int(header, 0) != TIMECODE_INDEX_VERSION) return false;
+    uint64_t movi_size = read_int(header, 4) | (uint64_t(read_int(header, 8)) << 32);
+    uint64_t count = read_int(header, 12);
+    if (movi_size != location.movi_size || TIMECODE_INDEX_HEADER + count * TIMECODE_SEGMENT_SIZE > location.index_size) {
+        return false; // Written for other media, e.g. before the file was edited
+    }
+
+    vector<uint8_t> segments = read_chunk(file, location.index_offset + 8 + TIMECODE_INDEX_HEADER, count * TIMECODE_SEGMENT_SIZE);
+    file.clear();
+    if (segments.size() != count * TIMECODE_SEGMENT_SIZE) return false;
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *p = &segments[i * TIMECODE_SEGMENT_SIZE];
+        add_timecode(timecodeDates, {p[0], p[1], p[2] | (p[3] << 8), p[4], p[5], p[6]});
+    }
+    return true;
+}
+
+// Function to embed the timecode index in the AVI: over an earlier 'dvtc' or a 'JUNK' padding
+// chunk when either is large enough, otherwise appended to the last RIFF, whose size grows with it
+bool write_timecode_index(const string &file_path, const vector<TimecodeSegment> &segments) {
+    fstream file(file_path, ios::binary | ios::in | ios::out);
+    ifstream reader(file_path, ios::binary | ios::ate);
+    if (!file.is_open() || !reader.is_open()) {
+        cerr << "Error opening " << file_path << " for writing the timecode index" << endl;
+        return false;
+    }
+    uint64_t file_size = reader.tellg();
+    IndexLocation location;
+    locate_index_chunks(reader, 0, file_size, location);
+    if (!location.movi_size) {
+        cerr << "No 'movi' list to index in " << file_path << endl;
+        return false;
+    }
+
+    vector<uint8_t> payload;
+    put_int(payload, TIMECODE_INDEX_VERSION, 4);
+    put_int(payload, location.movi_size, 8);
+    put_int(payload, segments.size(), 4);
+    for (const auto &segment : segments) {
+        const Timecode &t = segment.timecode;
+        for (int part : {t[0], t[1]}) put_int(payload, part, 1);
+        put_int(payload, t[2], 2);
+        for (int part : {t[3], t[4], t[5], 0}) put_int(payload, part, 1);
+        put_int(payload, segment.first_offset, 8);
+        put_int(payload, segment.frames, 4);
+        put_int(payload, 0, 4);
+    }
+
+    auto write_at = [&](uint64_t offset, const void *data, size_t size) {
+        file.seekp(offset);
+        file.write(static_cast<const char*>(data), size);
+    };
+    // Rewrites a padding or old index chunk in place, keeping its size; the unused tail is zeroed
+    auto fill_chunk = [&](uint64_t offset, uint64_t size) {
+        payload.resize(size, 0);
+        write_at(offset, "dvtc", 4);
+        write_at(offset + 8, payload.data(), payload.size());
+    };
+
+    string placement;
+    if (location.index_offset && location.index_size >= payload.size()) {
+        fill_chunk(location.index_offset, location.index_size);
+        placement = "over the previous index";
+    } else {
+        if (location.index_offset) write_at(location.index_offset, "JUNK", 4); // Too small now
+        if (location.junk_offset && location.junk_size >= payload.size()) {
+            fill_chunk(location.junk_offset, location.junk_size);
+            placement = "in JUNK padding";
+        } else {
+            // Appending only keeps the file valid if the last RIFF runs to the end of the file
+            uint64_t riff_size = (location.last_riff_end - location.last_riff - 8) + 8 + payload.size() + (payload.size() & 1);
+            if (location.last_riff_end != file_size || riff_size > UINT32_MAX) {
+                cerr << "No room for a timecode index in " << file_path << endl;
+                return false;
+            }
+            vector<uint8_t> chunk(payload.size() + 8 + (payload.size() & 1), 0);
+            memcpy(chunk.data(), "dvtc", 4);
+            vector<uint8_t> size_field;
+            put_int(size_field, payload.size(), 4);
+            memcpy(chunk.data() + 4, size_field.data(), 4);
+            memcpy(chunk.data() + 8, payload.data(), payload.size());
+            write_at(file_size, chunk.data(), chunk.size());
+            size_field.clear();
+            put_int(size_field, riff_size, 4);
+            write_at(location.last_riff + 4, size_field.data(), 4);
+            placement = "at the end of the RIFF";
+        }
+    }
+
+    file.flush();
+    if (!file) {
+        cerr << "Error writing the timecode index to " << file_path << endl;
+        return false;
+    }
+    if (debug) cerr << file_path << ": timecode index of " << segments.size() << " segments written " << placement << endl;
+    return true;
+}
+
+// Per-file summary cached in the 'user.dv2str.summary' extended attribute, so catalog scans
+// don't have to open the media. It is trusted only while the file's size and mtime match.
+const char SUMMARY_XATTR[] = "user.dv2str.summary";
+
+struct FileSummary {
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    uint64_t frames = 0;       // DV frames decoded
+    uint64_t valid_frames = 0; // Frames with a valid recording date and time
+    uint64_t segments = 0;     // Runs of frames with the same timecode
+    optional<Timecode> first, last;
+    uint64_t fingerprint = 0;  // FNV-1a of the first and last 64 KB
+};
+
+// Function to read the size and modification time the cached summary is validated against
+bool file_stamp(const string &file_path, uint64_t &size, int64_t &mtime_ns) {
+#ifdef __linux__
+    struct stat info{};
+    if (stat(file_path.c_str(), &info) != 0) return false;
+    size = info.st_size;
+    mtime_ns = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+#else
+    error_code error;
+    size = filesystem::file_size(file_path, error);
+    mtime_ns = filesystem::last_write_time(file_path, error).time_since_epoch().count();
+    return !error;
+#endif
+}
+
+// Function to fingerprint the content cheaply: the first and last 64 KB hashed with FNV-1a
+uint64_t content_fingerprint(ifstream &file, uint64_t size) {
+    const uint64_t SAMPLE = 64 * 1024;
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t start : {uint64_t(0), size > SAMPLE ? size - SAMPLE : 0}) {
+        for (uint8_t byte : read_chunk(file, start, min(size, SAMPLE))) {
+            hash = (hash ^ byte) * 1099511628211ull;
+        }
+        file.clear();
+        if (size <= SAMPLE) break;
+    }
+    return hash;
+}
+
+// Function to print a timecode as YYYY-MM-DDTHH:MM:SS, the form stored in the summary
+string format_iso_time(const Timecode &t) {
+    char text[32];
+    snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02d", t[2], t[1], t[0], t[3], t[4], t[5]);
+    return text;
+}
+
+// Function to load the cached summary; false if there is none or the file changed since
+bool load_summary(const string &file_path, FileSummary &summary) {
+#ifdef __linux__
+    char text[512];
+    ssize_t length = getxattr(file_path.c_str(), SUMMARY_XATTR, text, sizeof(text) - 1);
+    if (length <= 0) return false;
+    text[length] = '\0';
+
+    // A malformed number makes the summary stale, like any other mismatch, rather than aborting
+    auto parse_number = [](const string &value, auto &result, int base = 10) {
+        char *end = nullptr;
+        errno = 0;
+        if (is_signed<decay_t<decltype(result)>>::value) {
+            result = strtoll(value.c_str(), &end, base);
+        } else {
+            if (!value.empty() && value[0] == '-') return false;
+            result = strtoull(value.c_str(), &end, base);
+        }
+        return !value.empty() && errno == 0 && *end == '\0';
+    };
+
+    istringstream fields(text);
+    string field;
+    if (!(fields >> field) || field != "v1") return false;
+    while (fields >> field) {
+        size_t equals = field.find('=');
+        if (equals == string::npos) return false;
+        string key = field.substr(0, equals), value = field.substr(equals + 1);
+        Timecode t{};
+        bool parsed = true;
+        if (key == "first" || key == "last") {
+            if (sscanf(value.c_str(), "%d-%d-%dT%d:%d:%d", &t[2], &t[1], &t[0], &t[3], &t[4], &t[5]) != 6) return false;
+            (key == "first" ? summary.first : summary.last) = t;
+        } else if (key == "size") {
+            parsed = parse_number(value, summary.size);
+        } else if (key == "mtime") {
+            parsed = parse_number(value, summary.mtime_ns);
+        } else if (key == "frames") {
+            parsed = parse_number(value, summary.frames);
+        } else if (key == "valid") {
+            parsed = parse_number(value, summary.valid_frames);
+        } else if (key == "segments") {
+            parsed = parse_number(value, summary.segments);
+        } else if (key == "fingerprint") {
+            parsed = parse_number(value, summary.fingerprint, 16);
+        }
+        if (!parsed) return false;
+    }
+
+    uint64_t size = 0;
+    int64_t mtime_ns = 0;
+    return file_stamp(file_path, size, mtime_ns) && size == summary.size && mtime_ns == summary.mtime_ns;
+#else
+    return false;
+#endif
+}
+
+// Function to build the summary of a decoded file and store it on the file; errors are ignored
+// since many filesystems (and read-only media) have no user xattrs
+void store_summary(const string &file_path, const vector<TimecodeSegment> &segments, uint64_t frames,
+                   FileSummary *result) {
+    FileSummary summary;
+    if (!store_summaries && !result) return;
+    // A summary still valid for this size and mtime is left alone: no fingerprint read, no setxattr
+    if (!result && load_summary(file_path, summary)) return;
+    summary = FileSummary();
+    if (!file_stamp(file_path, summary.size, summary.mtime_ns)) return;
+    ifstream file(file_path, ios::binary);
+    summary.fingerprint = content_fingerprint(file, summary.size);
+    summary.frames = frames;
+    summary.segments = segments.size();
+    for (const auto &segment : segments) summary.valid_frames += segment.frames;
+    if (!segments.empty()) {
+        summary.first = segments.front().timecode;
+        summary.last = segments.back().timecode;
+    }
+    if (result) *result = summary;
+
+    ostringstream value;
+    value << "v1 size=" << summary.size << " mtime=" << summary.mtime_ns << " frames=" << summary.frames
+          << " valid=" << summary.valid_frames << " segments=" << summary.segments
+          << " fingerprint=" << hex << summary.fingerprint << dec;
+    if (summary.first) value << " first=" << format_iso_time(*summary.first) << " last=" << format_iso_time(*summary.last);
+#ifdef __linux__
+    string text = value.str();
+    if (setxattr(file_path.c_str(), SUMMARY_XATTR, text.data(), text.size(), 0) != 0 && debug) {
+        cerr << file_path << ": summary not cached (" << strerror(errno) << ")" << endl;
+    }
+#endif
+}
+
+// Function to scan a 'movi' list without an index, split into byte ranges scanned in parallel.
+// Each thread resynchronizes at the first trustworthy chunk header of its range and owns the
+// chunks that start inside it, reading a boundary-straddling frame past its range end. Afterwards
+// each boundary is checked: if the next thread synced somewhere the walk from the previous range
+// never reaches (a false header inside frame data), the gap is rewalked sequentially until both agree.
+vector<Timecode> scan_movi(const string &file_path, uint64_t movi_start, uint64_t movi_end, unsigned worker,
+                           vector<TimecodeSegment> &segments, uint64_t &frames, vector<FrameRecord> *records) {
+    const uint64_t MIN_RANGE = 4 * 1024 * 1024;
+    uint64_t first_chunk = movi_start + 4;
+    uint64_t length = movi_end > first_chunk ? movi_end - first_chunk : 0;
+    size_t threads = scan_threads ? scan_threads : max(1u, thread::hardware_concurrency());
+    threads = max<size_t>(1, min<size_t>(threads, length / MIN_RANGE));
+    if (scheduler_ticket) threads = 1; // A scheduled job gets the one thread its decode slot stands for
+
+    // One frame buffer per thread, drawn from the memory budget like the idx1 pipeline
+    BudgetReservation reservation;
+    memory_budget->reserve(MAX_FRAME_SIZE);
+    reservation.bytes = MAX_FRAME_SIZE;
+    size_t granted = 1;
+    while (granted < threads && memory_budget->try_reserve(MAX_FRAME_SIZE)) {
+        reservation.bytes += MAX_FRAME_SIZE;
+        ++granted;
+    }
+    threads = granted;
+
+    if (debug) {
+        cerr << file_path << ": no idx1, scanning " << length << " bytes of movi with " << threads << " threads" << endl;
+    }
+
+    SparseFile sparse(file_path);
+    vector<ScanRange> ranges(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        ranges[i].start = first_chunk + length * i / threads;
+        ranges[i].end = i + 1 == threads ? movi_end : first_chunk + length * (i + 1) / threads;
+    }
+
+    auto scan = [&](size_t i) {
+        ifstream file(file_path, ios::binary);
+        vector<uint8_t> buffer;
+        buffer.reserve(MAX_FRAME_SIZE);
+        StageTimer read_timer(STAGE_READ, worker), decode_timer(STAGE_DECODE, worker);
+        uint64_t start = i == 0 ? ranges[i].start : find_scan_start(file, ranges[i].start, movi_end, &sparse);
+        scan_chunks(file, start, ranges[i].end, movi_end, ranges[i], buffer, read_timer, decode_timer, &sparse);
+    };
+    vector<thread> scanners;
+    for (size_t i = 1; i < threads; ++i) scanners.emplace_back(scan, i);
+    scan(0);
+    for (auto &t : scanners) t.join();
+
+    // Repair boundaries where a range did not start exactly where the previous one stopped
+    ifstream file(file_path, ios::binary);
+    vector<uint8_t> buffer;
+    buffer.reserve(MAX_FRAME_SIZE);
+    StageTimer read_timer(STAGE_READ, worker), decode_timer(STAGE_DECODE, worker);
+    for (size_t i = 1; i < threads; ++i) {
+        ScanRange &next = ranges[i];
+        uint64_t expected = ranges[i - 1].stop;
+        if (!next.chunks.empty() && next.chunks.front() == expected) continue;
+
+        ScanRange gap;
+        scan_chunks(file, expected, movi_end, movi_end, gap, buffer, read_timer, decode_timer, &sparse, &next.chunks);
+        uint64_t synced = gap.stop;
+        if (debug) {
+            cerr << "Scan range " << i << " resynchronized at " << (next.chunks.empty() ? 0 : next.chunks.front())
+                 << ", rewalked from " << expected << " to " << synced << endl;
+        }
+
+        // Keep what the thread found from the agreed sync point on, preceded by the rewalked gap
+        auto valid = remove_if(next.timecodes.begin(), next.timecodes.end(),
+                               [&](const pair<uint64_t, optional<Timecode>> &t) { return t.first < synced; });
+        next.timecodes.erase(valid, next.timecodes.end());
+        next.timecodes.insert(next.timecodes.begin(), gap.timecodes.begin(), gap.timecodes.end());
+        // A thread that never reached the sync point is fully replaced by the rewalk
+        if (synced >= movi_end || !binary_search(next.chunks.begin(), next.chunks.end(), synced)) {
+            next.stop = gap.stop;
+        }
+    }
+
+    // Merge in frame order
+    vector<Timecode> timecodeDates;
+    for (const auto &range : ranges) {
+        for (const auto &entry : range.timecodes) {
+            add_frame_record(records, frames, entry.first, entry.second, FRAME_SCANNED);
+            frames++;
+            if (!entry.second) continue;
+            add_timecode(timecodeDates, *entry.second);
+            add_segment_frame(segments, *entry.second, entry.first);
+        }
+    }
+    return timecodeDates;
+}
+
+// Function to count the DV frames listed in a file's idx1, without reading any frame
+bool count_dv_frames(const string &file_path, uint64_t &frames, uint64_t &bytes) {
+    ifstream file(file_path, ios::binary);
+    vector<uint8_t> header = read_chunk(file, 0, 12);
+    size_t entries_offset = 0, num_entries = 0;
+    if (header.size() < 12 || read_string(header, 0) != "RIFF" || !find_idx1(file, 12, entries_offset, num_entries)) {
+        return false;
+    }
+    file.clear();
+
+    for (size_t first = 0; first < num_entries; first += MIN_INDEX_WINDOW) {
+        auto entries = parse_idx1(file, entries_offset, first, min(MIN_INDEX_WINDOW, num_entries - first));
+        file.clear();
+        if (entries.empty()) break;
+        for (const auto &entry : entries) {
+            if (entry.size == 144000 || entry.size == 120000) {
+                frames++;
+                bytes += entry.size;
+            }
+        }
+    }
+    return true;
+}
+
+// Main function to parse the AVI file
+// A decode also caches the file's summary in an xattr; summary, if given, receives it and forces a decode.
+// records, if given, receives one FrameRecord per frame and also forces a decode.
+vector<Timecode> parse_avi_file(const string &file_path, unsigned worker = 0, FileSummary *summary = nullptr,
+                                vector<FrameRecord> *records = nullptr) {
+    vector<Timecode> timecodeDates;
+    ifstream file(file_path, ios::binary);
+
+    if (!file.is_open()) {
+        cerr << "Error opening file: " << file_path << endl;
+        run_counters.files_failed++;
+        return timecodeDates;
+    }
+
+    size_t offset = parse_riff_header(file);
+    size_t entries_offset = 0, num_entries = 0;
+    if (offset == 0) {
+        run_counters.files_failed++;
+        return timecodeDates;
+    }
+
+    // A valid embedded index answers without reading a single frame
+    if (!write_index && !summary && !records) {
+        file.seekg(0, ios::end);
+        IndexLocation location;
+        locate_index_chunks(file, 0, file.tellg(), location);
+        if (read_timecode_index(file, location, timecodeDates)) {
+            if (debug) cerr << file_path << ": timecodes read from the embedded index" << endl;
+            uint64_t indexed_frames = 0, indexed_bytes = 0;
+            if (progress_mode != PROGRESS_OFF && count_dv_frames(file_path, indexed_frames, indexed_bytes)) {
+                progress.skipped_frames.fetch_add(indexed_frames, memory_order_relaxed);
+                progress.skipped_bytes.fetch_add(indexed_bytes, memory_order_relaxed);
+            }
+            run_counters.files_ok++;
+            return timecodeDates;
+        }
+    }
+
+    vector<TimecodeSegment> segments;
+    uint64_t frames = 0;
+    if (!find_idx1(file, offset, entries_offset, num_entries)) {
+        uint64_t movi_start = 0, movi_end = 0;
+        if (!find_movi(file, offset, movi_start, movi_end)) {
+            cerr << "No 'idx1' index or 'movi' list found in " << file_path << endl;
+            run_counters.files_failed++;
+            return timecodeDates;
+        }
+        file.close();
+        timecodeDates = scan_movi(file_path, movi_start, movi_end, worker, segments, frames, records);
+        if (write_index) write_timecode_index(file_path, segments);
+        store_summary(file_path, segments, frames, summary);
+        run_counters.files_ok++;
+        return timecodeDates;
+    }
+
+    // Entries may count from the file start or from 'movi'; probe the first one that points at a chunk
+    uint64_t base = 0, movi_start = 0, movi_end = 0;
+    if (find_movi(file, offset, movi_start, movi_end)) {
+        for (const auto &entry : parse_idx1(file, entries_offset, 0, min(num_entries, MIN_INDEX_WINDOW))) {
+            if (memcmp(entry.stream_id, "7Fxx", 4) == 0) continue;
+            base = idx1_base(file, entry, movi_start);
+            break;
+        }
+    }
+    file.close();
+
+    // Every file needs at least one frame buffer and a minimal index window; waiting
+    // here for other files to finish is what reduces concurrency under a tight budget
+    BudgetReservation reservation;
+    size_t minimum = MAX_FRAME_SIZE + MIN_INDEX_WINDOW * sizeof(IndexEntry);
+    memory_budget->reserve(minimum);
+    reservation.bytes = minimum;
+
+    // Grow the index window and the pipeline depth with whatever the budget still allows
+    size_t window = MIN_INDEX_WINDOW;
+    size_t wanted_window = min(max(num_entries, MIN_INDEX_WINDOW), MAX_INDEX_WINDOW);
+    size_t extra = (wanted_window - window) * sizeof(IndexEntry);
+    if (extra && memory_budget->try_reserve(extra)) {
+        reservation.bytes += extra;
+        window = wanted_window;
+    }
+
+    size_t depth = 1;
+    while (depth < pipeline_depth && memory_budget->try_reserve(MAX_FRAME_SIZE)) {
+        reservation.bytes += MAX_FRAME_SIZE;
+        ++depth;
+    }
+
+    if (debug) {
+        cerr << file_path << ": " << num_entries << " index entries, window " << window
+             << ", pipeline depth " << depth << endl;
+    }
+
+    FramePool pool(depth);
+    FrameQueue queue;
+    thread reader(read_frames, cref(file_path), entries_offset, num_entries, base, window, ref(pool), ref(queue), worker);
+    StageTimer timer(STAGE_DECODE, worker);
+
+    while (true) {
+        Frame frame = queue.pop();
+        if (!frame.buffer) break;
+
+        timer.begin();
+        auto results = get_dv_recording_time(*frame.buffer, frame.stream_id, frame.offset);
+        timer.end(frame.buffer->size());
+        if (progress_mode != PROGRESS_OFF || stats_report) {
+            progress.frames.fetch_add(1, memory_order_relaxed);
+            progress.bytes.fetch_add(frame.buffer->size(), memory_order_relaxed);
+            if (!results) run_counters.frames_rejected.fetch_add(1, memory_order_relaxed);
+        }
+        pool.release(frame.buffer);
+        add_frame_record(records, frames, frame.offset, results, 0);
+        frames++;
+        scheduler_checkpoint();
+
+        if (results) {
+            add_timecode(timecodeDates, *results);
+            add_segment_frame(segments, *results, frame.offset);
+        }
+    }
+
+    reader.join();
+    if (write_index) write_timecode_index(file_path, segments);
+    store_summary(file_path, segments, frames, summary);
+    run_counters.files_ok++;
+    return timecodeDates;
+}
+
+// Function to make a FOURCC printable, since damaged or zeroed ones are common
+string printable_fourcc(string fourcc) {
+    for (auto &c : fourcc) {
+        if (c < 32 || c > 126) c = '.';
+    }
+    return fourcc;
+}
+
+// Function to print one chunk of the RIFF tree, indented by depth
+void print_chunk(uint64_t offset, uint64_t size, const string &id, const string &detail, int depth) {
+    cout << setw(14) << offset << setw(14) << size << "  " << string(depth * 2, ' ') << printable_fourcc(id);
+    if (!detail.empty()) cout << " " << detail;
+    cout << endl;
+}
+
+// Function to walk the chunks between start and end, reading only their headers (plus the
+// 'strh' stream type with -d).
+// LIST/RIFF bodies are walked recursively, except 'movi' whose frames are only counted by idx1.
+void inspect_chunks(ifstream &file, uint64_t start, uint64_t end, int depth) {
+    uint64_t offset = start;
+    while (offset + 8 <= end) {
+        vector<uint8_t> header = read_chunk(file, offset, 12);
+        file.clear();
+        if (header.size() < 8) break;
+
+        string chunk_id = read_string(header, 0);
+        uint64_t chunk_size = read_int(header, 4);
+        uint64_t chunk_end = offset + 8 + chunk_size + (chunk_size & 1);
+        bool is_list = (chunk_id == "LIST" || chunk_id == "RIFF") && header.size() == 12;
+        string list_type = is_list ? read_string(header, 8) : "";
+
+        string detail = printable_fourcc(list_type);
+        if (list_type == "movi") detail += " (frames not walked)";
+        if (debug && chunk_id == "strh" && chunk_size >= 8) {
+            // The stream type and handler are the only payload bytes read, and only with -d
+            vector<uint8_t> types = read_chunk(file, offset + 8, 8); // fccType and fccHandler
+            file.clear();
+            if (types.size() == 8) detail = printable_fourcc(read_string(types, 0)) + " " + printable_fourcc(read_string(types, 4));
+        } else if (chunk_id == "idx1") {
+            detail = to_string(chunk_size / IDX1_ENTRY_SIZE) + " entries";
+        }
+        if (chunk_end > end) detail += " (truncated: extends past its parent)";
+        print_chunk(offset, chunk_size, chunk_id, detail, depth);
+
+        if (is_list && list_type != "movi") {
+            inspect_chunks(file, offset + 12, min(chunk_end, end), depth + 1);
+        }
+        offset = chunk_end;
+    }
+}
+
+// Function to print the RIFF layout of an AVI file (including OpenDML 'AVIX' extensions)
+bool inspect_avi_file(const string &file_path) {
+    ifstream file(file_path, ios::binary | ios::ate);
+    if (!file.is_open()) {
+        cerr << "Error opening file: " << file_path << endl;
+        return false;
+    }
+    uint64_t file_size = file.tellg();
+
+    cout << file_path << " (" << file_size << " bytes)" << endl;
+    cout << setw(14) << "offset" << setw(14) << "size" << "  chunk" << endl;
+    inspect_chunks(file, 0, file_size, 0);
+    return true;
+}
+
+// Function to find the top-level 'movi' LIST and 'idx1' chunk of the first RIFF
+bool find_movi_and_idx1(ifstream &file, uint64_t &movi_start, uint64_t &movi_end,
+                        uint64_t &entries_offset, size_t &num_entries) {
+    vector<uint8_t> riff = read_chunk(file, 0, 12);
+    if (riff.size() < 12 || read_string(riff, 0) != "RIFF") return false;
+
+    bool found_movi = false;
+    ChunkWalker walker(file, 12);
+    string chunk_id, list_type;
+    uint64_t chunk_size = 0, offset = 0;
+    while (walker.next(chunk_id, chunk_size, offset, list_type)) {
+        if (chunk_id == "LIST" && list_type == "movi") {
+            movi_start = offset + 8; // idx1 offsets are relative to the 'movi' FOURCC
+            movi_end = offset + 8 + chunk_size;
+            found_movi = true;
+        } else if (chunk_id == "idx1") {
+            entries_offset = offset + 8;
+            num_entries = chunk_size / IDX1_ENTRY_SIZE;
+            if (!found_movi) {
+                // The walker resynchronized past a damaged 'movi' header; bound it by the RIFF body instead
+                cerr << "Warning: 'movi' list header not found, using the RIFF body as its bounds" << endl;
+                movi_start = 12;
+                movi_end = offset;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to check every idx1 entry against the chunk header it points at.
+// Headers are read in coalesced spans: entries whose headers lie close together share one read.
+bool validate_avi_file(const string &file_path) {
+    ifstream file(file_path, ios::binary);
+    uint64_t movi_start = 0, movi_end = 0, entries_offset = 0;
+    size_t num_entries = 0;
+    if (!file.is_open() || !find_movi_and_idx1(file, movi_start, movi_end, entries_offset, num_entries)) {
+        cerr << file_path << ": no 'movi' list and 'idx1' index to validate" << endl;
+        return false;
+    }
+
+    const uint64_t MAX_GAP = 16 * 1024, MAX_SPAN = 64 * 1024;
+    const size_t MAX_REPORTED = 20;
+    uint64_t base = 0; // Decided on the first entry: absolute offsets or relative to movi
+    bool base_known = false;
+    size_t mismatches = 0, reads = 0, padding = 0;
+    vector<uint8_t> span;
+
+    for (size_t first = 0; first < num_entries; first += MAX_INDEX_WINDOW) {
+        auto entries = parse_idx1(file, entries_offset, first, min(MAX_INDEX_WINDOW, num_entries - first));
+        file.clear();
+        if (entries.empty()) break;
+
+        // '7Fxx' entries are padding some capture tools write into idx1; they point at nothing
+        vector<size_t> order;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (memcmp(entries[i].stream_id, "7Fxx", 4) == 0) {
+                padding++;
+            } else {
+                order.push_back(i);
+            }
+        }
+
+        if (!base_known && !order.empty()) {
+            base_known = true;
+            base = idx1_base(file, entries[order[0]], movi_start);
+        }
+
+        // Visit entries in file order so neighbouring headers can be coalesced
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return entries[a].offset < entries[b].offset; });
+
+        for (size_t group = 0; group < order.size();) {
+            uint64_t span_start = base + entries[order[group]].offset;
+            size_t group_end = group + 1;
+            while (group_end < order.size()) {
+                uint64_t next = base + entries[order[group_end]].offset;
+                uint64_t previous = base + entries[order[group_end - 1]].offset;
+                if (next - previous > MAX_GAP || next + 8 - span_start > MAX_SPAN) break;
+                ++group_end;
+            }
+            uint64_t span_end = base + entries[order[group_end - 1]].offset + 8;
+            span = read_chunk(file, span_start, span_end - span_start);
+            file.clear();
+            reads++;
+
+            for (size_t k = group; k < group_end; ++k) {
+                const IndexEntry &entry = entries[order[k]];
+                uint64_t position = base + entry.offset;
+                uint64_t relative = position - span_start;
+                string expected = string(entry.stream_id, 4);
+                string problem;
+
+                if (position < movi_start + 4 || position + 8 + entry.size > movi_end) {
+                    problem = "outside the 'movi' list";
+                } else if (relative + 8 > span.size()) {
+                    problem = "header past the end of the file";
+                } else if (read_string(span, relative) != expected) {
+                    problem = "found chunk " + printable_fourcc(read_string(span, relative));
+                } else if (read_int(span, relative + 4) != entry.size) {
+                    problem = "chunk size is " + to_string(read_int(span, relative + 4));
+                }
+
+                if (!problem.empty()) {
+                    if (mismatches < MAX_REPORTED) {
+                        cout << "entry " << first + order[k] << ": " << printable_fourcc(expected) << " size "
+                             << entry.size << " at " << position << ": " << problem << endl;
+                    }
+                    mismatches++;
+                }
+            }
+            group = group_end;
+        }
+    }
+
+    if (mismatches > MAX_REPORTED) cout << "... " << mismatches - MAX_REPORTED << " more" << endl;
+    cout << file_path << ": " << num_entries << " index entries checked with " << reads << " reads ("
+         << (base ? "movi-relative" : "absolute") << " offsets), " << padding << " padding entries skipped, "
+         << mismatches << " mismatches" << endl;
+    return mismatches == 0;
+}
+
+// DIF blocks are 80 bytes; each DIF sequence holds 150 of them, and a frame has 10 (NTSC) or 12 (PAL)
+const size_t DIF_BLOCK_SIZE = 80;
+const size_t DIF_SEQUENCE_SIZE = 150 * DIF_BLOCK_SIZE;
+
+// Function to check a DIF block ID: section type in the top 3 bits of byte 0, sequence number in byte 1
+bool is_dif_block(const uint8_t *p, int section_type, size_t sequence) {
+    return (p[0] >> 5) == section_type && size_t(p[1] >> 4) == sequence;
+}
+
+// Function to validate a candidate frame by its DIF structure; returns the frame size, or 0.
+// Every sequence must start with a header block carrying its number, followed by two subcode
+// blocks, three VAUX blocks, then audio and video blocks.
+size_t dv_frame_size_at(const uint8_t *p, size_t available) {
+    size_t sequences = (p[3] & 0x80) ? 12 : 10; // DSF bit: PAL or NTSC
+    size_t size = sequences * DIF_SEQUENCE_SIZE;
+    if (available < size) return 0;
+
+    const int layout[8] = {0, 1, 1, 2, 2, 2, 3, 4}; // Header, subcode, VAUX, audio, video
+    for (size_t i = 0; i < sequences; ++i) {
+        const uint8_t *sequence = p + i * DIF_SEQUENCE_SIZE;
+        for (size_t k = 0; k < 8; ++k) {
+            if (!is_dif_block(sequence + k * DIF_BLOCK_SIZE, layout[k], i)) return 0;
+        }
+    }
+    return size;
+}
+
+// Function to find the next possible frame start: a header block of sequence 0 (ID bytes
+// xx 07 00 with section type 0). SSE2 matches bytes 1 and 2 for 16 positions at a time.
+size_t find_dif_signature(const uint8_t *data, size_t from, size_t limit) {
+    size_t i = from;
+#ifdef __SSE2__
+    const __m128i seven = _mm_set1_epi8(0x07), zero = _mm_setzero_si128();
+    for (; i + 18 <= limit; i += 16) {
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 1));
+        __m128i third = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(second, seven), _mm_cmpeq_epi8(third, zero)));
+        for (; mask; mask &= mask - 1) {
+            size_t position = i + __builtin_ctz(mask);
+            if ((data[position] & 0xE0) == 0) return position;
+        }
+    }
+#endif
+    for (; i + 3 <= limit; ++i) {
+        if ((data[i] & 0xE0) == 0 && data[i + 1] == 0x07 && data[i + 2] == 0x00) return i;
+    }
+    return limit;
+}
+
+// A run of consecutive frames recovered by carve, written to one .dv file
+struct CarvedRun {
+    uint64_t offset = 0;
+    uint64_t end = 0;
+    size_t frame_size = 0;
+    size_t frames = 0;
+    optional<Timecode> first, last;
+    string path;
+    ofstream out;
+};
+
+// Function to print a timecode in the "Timecode: d m y h m s" output format
+void print_timecode(const Timecode &timecode, ostream &out = cout) {
+    out << "Timecode: ";
+    for (int part : timecode) {
+        out << part << " ";
+    }
+    out << endl;
+}
+
+// Function to print a timecode as DD/MM/YYYY HH:MM:SS
+string format_timecode(const Timecode &t) {
+    ostringstream out;
+    out << setfill('0') << setw(2) << t[0] << "/" << setw(2) << t[1] << "/" << t[2] << " "
+        << setw(2) << t[3] << ":" << setw(2) << t[4] << ":" << setw(2) << t[5];
+    return out.str();
+}
+
+// Function to recover DV frames from a raw disk image or block device, with no filesystem or
+// container needed. The image is streamed through a fixed window (8 MB plus one frame), so memory
+// stays bounded for any image size. Frames close together with the same format form a run.
+bool carve_dv_frames(const string &image_path, const string &output_dir) {
+    ifstream image(image_path, ios::binary);
+    if (!image.is_open()) {
+        cerr << "Error opening image: " << image_path << endl;
+        return false;
+    }
+    error_code error;
+    filesystem::create_directories(output_dir, error);
+
+    const size_t BLOCK = 8 << 20;
+    const uint64_t MAX_RUN_GAP = 1 << 20; // AVI chunk headers, audio and JUNK between frames
+    vector<uint8_t> window(BLOCK + MAX_FRAME_SIZE);
+    vector<uint8_t> frame;
+    frame.reserve(MAX_FRAME_SIZE);
+    uint64_t base = 0;      // Image offset of window[0]
+    size_t valid = 0, position = 0;
+    bool eof = false;
+    CarvedRun run;
+    size_t runs = 0, total_frames = 0;
+    SparseFile sparse(image_path);
+    image.seekg(0, ios::end);
+    uint64_t image_size = image.tellg(); // 0 for block devices, which have no holes to skip
+    image.seekg(0);
+    uint64_t skipped_before = sparse_skipped_bytes;
+
+    auto finish_run = [&] {
+        if (!run.frames) return;
+        run.out.close();
+        cout << "run " << runs << ": offset " << run.offset << ", " << run.frames << " frames ("
+             << (run.frame_size == 144000 ? "PAL" : "NTSC") << ")";
+        if (run.first) cout << ", " << format_timecode(*run.first) << " - " << format_timecode(*run.last);
+        cout << " -> " << run.path << endl;
+        run.frames = 0;
+        run.first.reset();
+        run.last.reset();
+    };
+
+    while (true) {
+        // Keep at least one whole frame ahead of the scan position
+        if (!eof && valid - position < MAX_FRAME_SIZE) {
+            // A hole can't hold a frame, so the partial tail before it is dropped with it
+            uint64_t read_offset = base + valid;
+            uint64_t data = image_size ? sparse.next_data(read_offset, image_size) : read_offset;
+            if (data > read_offset) {
+                base = data;
+                valid = position = 0;
+                image.clear();
+                image.seekg(data);
+            }
+            memmove(window.data(), window.data() + position, valid - position);
+            base += position;
+            valid -= position;
+            position = 0;
+            image.read(reinterpret_cast<char*>(window.data() + valid), window.size() - valid);
+            valid += image.gcount();
+            eof = image.gcount() == 0 || !image;
+        }
+
+        size_t limit = eof ? valid : valid - MAX_FRAME_SIZE + 1;
+        size_t candidate = find_dif_signature(window.data(), position, limit);
+        if (candidate >= limit) {
+            if (eof) break;
+            position = limit;
+            continue;
+        }
+
+        size_t size = dv_frame_size_at(window.data() + candidate, valid - candidate);
+        if (!size) {
+            position = candidate + 1;
+            continue;
+        }
+
+        uint64_t frame_offset = base + candidate;
+        if (run.frames && (size != run.frame_size || frame_offset - run.end > MAX_RUN_GAP)) finish_run();
+        if (!run.frames) {
+            ostringstream name;
+            name << "run_" << setfill('0') << setw(4) << ++runs << ".dv";
+            run.path = (filesystem::path(output_dir) / name.str()).string();
+            run.out.open(run.path, ios::binary);
+            if (!run.out) {
+                cerr << "Error creating " << run.path << endl;
+                return false;
+            }
+            run.offset = frame_offset;
+            run.frame_size = size;
+        }
+
+        frame.assign(window.data() + candidate, window.data() + candidate + size);
+        auto results = get_dv_recording_time(frame, "carve", frame_offset);
+        if (results) {
+            if (!run.first) run.first = results;
+            run.last = results;
+        }
+        run.out.write(reinterpret_cast<const char*>(frame.data()), size);
+        run.frames++;
+        run.end = frame_offset + size;
+        total_frames++;
+        position = candidate + size;
+    }
+    finish_run();
+
+    uint64_t skipped = sparse_skipped_bytes - skipped_before;
+    cout << image_path << ": " << total_frames << " frames recovered in " << runs << " runs ("
+         << base + valid - skipped << " bytes scanned, " << skipped << " bytes of holes skipped)" << endl;
+    return total_frames > 0;
+}
+
+// Function to read exactly size bytes from a stream that may not seek (pipes, tape)
+bool read_exact(istream &in, uint8_t *data, size_t size) {
+    in.read(reinterpret_cast<char*>(data), size);
+    return static_cast<size_t>(in.gcount()) == size;
+}
+
+// Function to discard size bytes by reading them, since tar streams can't seek
+bool skip_bytes(istream &in, uint64_t size) {
+    while (size) {
+        streamsize step = min<uint64_t>(size, 1 << 30);
+        in.ignore(step);
+        if (in.gcount() != step) return false;
+        size -= step;
+    }
+    return true;
+}
+
+// Function to parse a tar number field: NUL/space-terminated octal, or GNU base-256 for large sizes
+uint64_t parse_tar_number(const uint8_t *field, size_t length) {
+    uint64_t value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < length; ++i) value = (value << 8) | field[i];
+        return value;
+    }
+    for (size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+// Function to pass the DV frames of an AVI read front to back from a stream to on_frame, never
+// seeking. RIFF/AVIX and the 'movi' and 'rec ' LISTs are walked into; every other chunk is skipped.
+// Consumes exactly size bytes of the stream unless it ends early; returns whether it was an AVI.
+bool walk_avi_stream(istream &in, uint64_t size, const string &name,
+                     const function<void(const string &, uint64_t, const vector<uint8_t> &)> &on_frame) {
+    vector<uint8_t> buffer;
+    buffer.reserve(MAX_FRAME_SIZE);
+    uint8_t header[12];
+    uint64_t position = min<uint64_t>(size, 12);
+
+    bool is_avi = read_exact(in, header, position) && position == 12 &&
+                  memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "AVI ", 4) == 0;
+    if (!is_avi) {
+        if (debug) cerr << name << ": not an AVI file, skipped" << endl;
+        skip_bytes(in, size - position);
+        return false;
+    }
+
+    while (position + 8 <= size) {
+        if (!read_exact(in, header, 8)) return true;
+        position += 8;
+        string chunk_id(reinterpret_cast<char*>(header), 4);
+        uint64_t chunk_size = header[4] | (header[5] << 8) | (header[6] << 16) | (uint64_t(header[7]) << 24);
+
+        if (chunk_id == "RIFF" || chunk_id == "LIST") {
+            if (position + 4 > size || !read_exact(in, header + 8, 4)) return true;
+            position += 4;
+            string list_type(reinterpret_cast<char*>(header + 8), 4);
+            if (chunk_id == "RIFF" || list_type == "movi" || list_type == "rec ") continue;
+            chunk_size = chunk_size >= 4 ? chunk_size - 4 : 0;
+        }
+
+        // Without seeking there is no resynchronizing on a damaged size; the rest is skipped
+        uint64_t padded = chunk_size + (chunk_size & 1);
+        if (position + chunk_size > size) {
+            cerr << name << ": chunk '" << printable_fourcc(chunk_id) << "' at " << position - 8
+                 << " runs past the end of the file, rest skipped" << endl;
+            break;
+        }
+        padded = min(padded, size - position);
+
+        if ((chunk_size == 144000 || chunk_size == 120000) && chunk_id[2] == 'd') {
+            buffer.resize(chunk_size);
+            if (!read_exact(in, buffer.data(), chunk_size)) return true;
+            if (padded > chunk_size && !skip_bytes(in, padded - chunk_size)) return true;
+            on_frame(chunk_id, position - 8, buffer);
+        } else if (!skip_bytes(in, padded)) {
+            return true;
+        }
+        position += padded;
+    }
+    skip_bytes(in, size - position);
+    return true;
+}
+
+// Function to process the AVI members of a tar archive read strictly in order, for archives
+// streamed from tape or a pipe ("-" reads stdin). Results are printed as each member ends.
+bool process_tar_stream(const string &archive_path) {
+    ifstream archive;
+    if (archive_path != "-") {
+        archive.open(archive_path, ios::binary);
+        if (!archive.is_open()) {
+            cerr << "Error opening archive: " << archive_path << endl;
+            return false;
+        }
+    }
+    istream &in = archive_path == "-" ? cin : archive;
+
+    const size_t BLOCK = 512;
+    uint8_t block[BLOCK];
+    string long_name;
+    size_t members = 0;
+    bool finished = false;
+    while (read_exact(in, block, BLOCK)) {
+        finished = all_of(block, block + BLOCK, [](uint8_t b) { return b == 0; }); // End-of-archive marker
+        if (finished) break;
+
+        uint64_t size = parse_tar_number(block + 124, 12);
+        uint64_t padding = (BLOCK - size % BLOCK) % BLOCK;
+        char type = block[156];
+
+        // GNU long names and pax headers carry the name of the member that follows
+        if (type == 'L' || type == 'x') {
+            string data(size, '\0');
+            if (!read_exact(in, reinterpret_cast<uint8_t*>(&data[0]), size) || !skip_bytes(in, padding)) break;
+            if (type == 'L') {
+                long_name = data.c_str();
+            } else {
+                for (size_t pos = 0; pos < data.size();) { // Records are "<length> <key>=<value>\n"
+                    size_t length = strtoul(data.c_str() + pos, nullptr, 10);
+                    if (!length) break;
+                    string record = data.substr(pos, length);
+                    size_t key = record.find(" path=");
+                    if (key != string::npos) long_name = record.substr(key + 6, record.size() - key - 7);
+                    pos += length;
+                }
+            }
+            continue;
+        }
+
+        string name = long_name;
+        long_name.clear();
+        if (name.empty()) {
+            string prefix(reinterpret_cast<char*>(block + 345), strnlen(reinterpret_cast<char*>(block + 345), 155));
+            name.assign(reinterpret_cast<char*>(block), strnlen(reinterpret_cast<char*>(block), 100));
+            if (!prefix.empty()) name = prefix + "/" + name;
+        }
+
+        if (type != '0' && type != '\0' && type != '7') { // Only regular files hold AVIs
+            if (!skip_bytes(in, size + padding)) break;
+            continue;
+        }
+
+        vector<Timecode> timecodes;
+        bool is_avi = walk_avi_stream(in, size, name, [&](const string &chunk_id, uint64_t offset, const vector<uint8_t> &frame) {
+            auto results = get_dv_recording_time(frame, chunk_id, offset);
+            if (results) add_timecode(timecodes, *results);
+        });
+        if (!skip_bytes(in, padding)) break;
+        if (!is_avi) continue;
+        members++;
+        cout << "File: " << name << endl;
+        for (const auto &timecode : timecodes) print_timecode(timecode);
+    }
+
+    if (!finished) {
+        cerr << "Error reading archive: " << archive_path << (in.bad() ? "" : " (ends early)") << endl;
+        return false;
+    }
+    if (debug) cerr << archive_path << ": " << members << " AVI members read" << endl;
+    return true;
+}
+
+// Function to tell from its first bytes whether a file is an AVI holding DV, whatever its name:
+// 'RIFF'/'AVI ' and a DV handler or compression FOURCC among the stream headers
+bool is_dv_avi(const uint8_t *data, size_t size) {
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "AVI ", 4) != 0) return false;
+    static const char *const DV_FOURCCS[] = {"dvsd", "DVSD", "dv25", "DV25", "dvsl", "dvhd", "dv50", "DV50",
+                                             "dvcp", "dvpp", "CDVC", "iavs"};
+    for (size_t i = 12; i + 4 <= size; ++i) {
+        for (const char *fourcc : DV_FOURCCS) {
+            if (memcmp(data + i, fourcc, 4) == 0) return true;
+        }
+    }
+    return false;
+}
+
+// Function to tell whether the catalog should look at a file, from its name and xattrs alone:
+// a cached summary or an .avi extension. The file's data is never opened.
+bool is_catalog_candidate(const string &path) {
+#ifdef __linux__
+    if (getxattr(path.c_str(), SUMMARY_XATTR, nullptr, 0) > 0) return true;
+#endif
+    string extension = filesystem::path(path).extension().string();
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".avi";
+}
+
+// Parallel directory traversal for large (and slow, e.g. NFS) trees. Each thread reads whole
+// directories with getdents64 and keeps the subdirectories it finds in its own deque, taking from
+// the back (depth first) and stealing from the front of the others' when it runs dry. Files are
+// sniffed as they are found and the DV AVIs passed to on_file right away, from any crawler thread.
+// Without sniff_content, files are chosen by is_catalog_candidate instead and never opened.
+class DirectoryCrawler {
+public:
+    DirectoryCrawler(const vector<string> &roots, unsigned threads, function<void(const string &)> on_file,
+                     bool sniff_content = true)
+            : on_file(move(on_file)), sniff_content(sniff_content) {
+        threads = max(1u, threads);
+        for (unsigned i = 0; i < threads; ++i) queues.push_back(make_unique<WorkQueue>());
+        for (size_t i = 0; i < roots.size(); ++i) push(i % threads, roots[i]);
+        for (unsigned i = 0; i < threads; ++i) crawlers.emplace_back(&DirectoryCrawler::run, this, i);
+    }
+
+    ~DirectoryCrawler() { wait(); }
+
+    // Blocks until every directory has been read
+    void wait() {
+        for (auto &t : crawlers) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    size_t directories_read() const { return directories; }
+
+private:
+    struct WorkQueue {
+        mutex mtx;
+        deque<string> directories;
+    };
+
+    void push(size_t queue, const string &path) {
+        pending++;
+        lock_guard<mutex> lock(queues[queue]->mtx);
+        queues[queue]->directories.push_back(path);
+    }
+
+    bool take(size_t self, string &path) {
+        for (size_t i = 0; i < queues.size(); ++i) {
+            WorkQueue &queue = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> lock(queue.mtx);
+            if (queue.directories.empty()) continue;
+            if (i == 0) {
+                path = move(queue.directories.back());
+                queue.directories.pop_back();
+            } else {
+                path = move(queue.directories.front()); // Steal the oldest, likely the largest subtree
+                queue.directories.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        string path;
+        while (true) {
+            if (take(self, path)) {
+                read_directory(self, path);
+                directories++;
+                pending--;
+            } else if (pending == 0) {
+                return; // Nothing queued and nobody left reading who could queue more
+            } else {
+                this_thread::sleep_for(chrono::microseconds(200));
+            }
+        }
+    }
+
+#ifdef __linux__
+    void sniff(const string &path, int fd) {
+        uint8_t head[4096];
+        ssize_t length = pread(fd, head, sizeof(head), 0);
+        if (length > 0 && is_dv_avi(head, length)) {
+            on_file(path);
+        } else if (debug) {
+            cerr << path << ": not a DV AVI, skipped" << endl;
+        }
+    }
+
+    struct Dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    void read_directory(size_t self, const string &path) {
+        int dir = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir < 0) {
+            cerr << "Error reading directory " << path << ": " << strerror(errno) << endl;
+            return;
+        }
+        // Large buffer: on network filesystems each getdents64 call is a round trip
+        vector<char> buffer(256 * 1024);
+        while (true) {
+            long length = syscall(SYS_getdents64, dir, buffer.data(), buffer.size());
+            if (length <= 0) break;
+            for (long position = 0; position < length;) {
+                auto *entry = reinterpret_cast<Dirent64*>(buffer.data() + position);
+                position += entry->d_reclen;
+                const char *name = entry->d_name;
+                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+
+                string child = path + (path.back() == '/' ? "" : "/") + name;
+                unsigned char type = entry->d_type;
+                struct stat info{};
+                if (type == DT_UNKNOWN || type == DT_LNK) {
+                    // Symlinked files are followed, symlinked directories are not (no cycles)
+                    if (fstatat(dir, name, &info, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    if (S_ISREG(info.st_mode)) {
+                        type = DT_REG;
+                    } else if (S_ISDIR(info.st_mode) && type == DT_UNKNOWN) {
+                        type = DT_DIR;
+                    } else {
+                        continue;
+                    }
+                }
+                if (type == DT_DIR) {
+                    push(self, child);
+                } else if (type == DT_REG && !sniff_content) {
+                    if (is_catalog_candidate(child)) on_file(child);
+                } else if (type == DT_REG) {
+                    int fd = openat(dir, name, O_RDONLY | O_CLOEXEC);
+                    if (fd < 0) continue;
+                    sniff(child, fd);
+                    close(fd);
+                }
+            }
+        }
+        close(dir);
+    }
+#else
+    void read_directory(size_t self, const string &path) {
+        error_code error;
+        for (const auto &entry : filesystem::directory_iterator(path, filesystem::directory_options::skip_permission_denied, error)) {
+            if (entry.is_directory(error) && !entry.is_symlink(error)) {
+                push(self, entry.path().string());
+            } else if (entry.is_regular_file(error) && !sniff_content) {
+                if (is_catalog_candidate(entry.path().string())) on_file(entry.path().string());
+            } else if (entry.is_regular_file(error)) {
+                ifstream file(entry.path(), ios::binary);
+                uint8_t head[4096];
+                file.read(reinterpret_cast<char*>(head), sizeof(head));
+                if (is_dv_avi(head, file.gcount())) on_file(entry.path().string());
+            }
+        }
+    }
+#endif
+
+    function<void(const string &)> on_file;
+    bool sniff_content;
+    vector<unique_ptr<WorkQueue>> queues;
+    atomic<size_t> pending{0};
+    atomic<size_t> directories{0};
+    vector<thread> crawlers;
+};
+
+// Function to get a file's summary from its xattr, decoding the file only when that is missing or stale
+bool get_summary(const string &file_path, FileSummary &summary, bool &cached) {
+    cached = load_summary(file_path, summary);
+    if (cached) return true;
+    summary = FileSummary();
+    uint64_t failed = run_counters.files_failed;
+    parse_avi_file(file_path, 0, &summary);
+    return run_counters.files_failed == failed;
+}
+
+// Function to list the files given directly and the DV AVIs found under the given directories, in
+// sorted order. sniff_content picks them by their first bytes, which opens every file; without it
+// they are picked by name and cached summary only (is_catalog_candidate).
+vector<string> collect_avi_files(const vector<string> &paths, bool sniff_content) {
+    vector<string> files, roots;
+    for (const auto &path : paths) {
+        error_code error;
+        (filesystem::is_directory(path, error) ? roots : files).push_back(path);
+    }
+    mutex mtx;
+    vector<string> found;
+    DirectoryCrawler(roots, crawl_threads, [&](const string &path) {
+        lock_guard<mutex> lock(mtx);
+        found.push_back(path);
+    }, sniff_content).wait();
+    sort(found.begin(), found.end()); // Crawl order varies from run to run
+    files.insert(files.end(), found.begin(), found.end());
+    return files;
+}
+
+// Function to print one tab-separated catalog line per file from the cached summaries
+bool catalog_files(const vector<string> &paths) {
+    bool ok = true;
+    size_t cached_count = 0;
+    vector<string> files = collect_avi_files(paths, false); // A catalog of cached files must not read their media
+    cout << "file\tfirst\tlast\tsegments\tframes\tvalid\tsource" << endl;
+    for (const auto &file_path : files) {
+        FileSummary summary;
+        bool cached = false;
+        if (!get_summary(file_path, summary, cached)) {
+            ok = false;
+            continue;
+        }
+        cached_count += cached;
+        cout << file_path << "\t" << (summary.first ? format_iso_time(*summary.first) : "-") << "\t"
+             << (summary.last ? format_iso_time(*summary.last) : "-") << "\t" << summary.segments << "\t"
+             << summary.frames << "\t" << fixed << setprecision(1)
+             << (summary.frames ? 100.0 * summary.valid_frames / summary.frames : 0.0) << "%\t"
+             << (cached ? "cached" : "decoded") << endl;
+    }
+    if (debug) cerr << files.size() << " files, " << cached_count << " from cached summaries" << endl;
+    return ok;
+}
+
+// Function to print every field of a file's summary
+bool probe_file(const string &file_path) {
+    FileSummary summary;
+    bool cached = false;
+    if (!get_summary(file_path, summary, cached)) return false;
+    cout << "File: " << file_path << endl;
+    cout << "Source: " << (cached ? "cached summary" : "decoded") << endl;
+    cout << "Size: " << summary.size << " bytes" << endl;
+    cout << "First recording time: " << (summary.first ? format_timecode(*summary.first) : "-") << endl;
+    cout << "Last recording time: " << (summary.last ? format_timecode(*summary.last) : "-") << endl;
+    cout << "Segments: " << summary.segments << endl;
+    cout << "Frames: " << summary.frames << " (" << summary.valid_frames << " with a valid timecode)" << endl;
+    cout << "Fingerprint: " << hex << setw(16) << setfill('0') << summary.fingerprint << dec << setfill(' ') << endl;
+    return true;
+}
+
+// Files to process: the ones named on the command line, plus those found while directories are
+// still being crawled, so decoding starts before the crawl is done
+class JobQueue {
+public:
+    void push(const string &path) {
+        {
+            lock_guard<mutex> lock(mtx);
+            paths.push_back(path);
+        }
+        ready.notify_one();
+    }
+
+    // No more files will come
+    void close() {
+        {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+    // Takes the next file, waiting for the crawl to find one; false once every file is taken
+    bool pop(size_t &index, string &path) {
+        unique_lock<mutex> lock(mtx);
+        ready.wait(lock, [&] { return next < paths.size() || closed; });
+        if (next >= paths.size()) return false;
+        index = next++;
+        path = paths[index];
+        return true;
+    }
+
+    bool path_at(size_t index, string &path) const {
+        lock_guard<mutex> lock(mtx);
+        if (index >= paths.size()) return false;
+        path = paths[index];
+        return true;
+    }
+
+    bool is_closed() const {
+        lock_guard<mutex> lock(mtx);
+        return closed;
+    }
+
+    size_t size() const {
+        lock_guard<mutex> lock(mtx);
+        return paths.size();
+    }
+
+private:
+    mutable mutex mtx;
+    condition_variable ready;
+    vector<string> paths;
+    size_t next = 0;
+    bool closed = false;
+};
+
+// Background thread that prints progress at a fixed interval. Totals come from a quick
+// pass over every idx1 made by the same thread, so the workers start immediately.
+class ProgressReporter {
+public:
+    explicit ProgressReporter(const JobQueue &jobs)
+            : jobs(jobs), started(chrono::steady_clock::now()) {
+        reporter = thread(&ProgressReporter::run, this);
+    }
+
+    ~ProgressReporter() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        reporter.join();
+        render(); // Final line with the complete totals
+        if (progress_mode == PROGRESS_TEXT) cerr << endl;
+    }
+
+private:
+    // Totals grow as files are found and are known once the crawl is over and every file counted
+    void count_new_files() {
+        bool closed = jobs.is_closed();
+        string path;
+        while (jobs.path_at(counted, path)) {
+            uint64_t frames = 0, bytes = 0;
+            count_dv_frames(path, frames, bytes);
+            frames_total += frames;
+            bytes_total += bytes;
+            counted++;
+            if (is_stopping()) return;
+        }
+        if (closed) totals_known = true;
+    }
+
+    void run() {
+        count_new_files();
+        unique_lock<mutex> lock(mtx);
+        while (!wake.wait_for(lock, chrono::seconds(1), [&] { return stopping; })) {
+            lock.unlock();
+            if (!totals_known) count_new_files();
+            render();
+            lock.lock();
+        }
+    }
+
+    bool is_stopping() {
+        lock_guard<mutex> lock(mtx);
+        return stopping;
+    }
+
+    void render() {
+        uint64_t frames = progress.frames.load(memory_order_relaxed);
+        uint64_t bytes = progress.bytes.load(memory_order_relaxed);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        double mb_per_sec = elapsed > 0 ? bytes / 1e6 / elapsed : 0;
+        double frames_per_sec = elapsed > 0 ? frames / elapsed : 0;
+        bool known = totals_known;
+        // Scanned frames join the totals as they are found, so index-less files never push past 100%,
+        // and frames that an embedded index spared from decoding leave them
+        uint64_t frames_total = 0, bytes_total = 0;
+        if (known) {
+            frames_total = this->frames_total.load() + progress.scanned_frames.load();
+            bytes_total = this->bytes_total.load() + progress.scanned_bytes.load();
+            frames_total -= min(frames_total, progress.skipped_frames.load());
+            bytes_total -= min(bytes_total, progress.skipped_bytes.load());
+        }
+        double eta = (bytes > 0 && bytes_total > bytes) ? elapsed * (bytes_total - bytes) / bytes : 0;
+
+        if (progress_mode == PROGRESS_JSON) {
+            cerr << "{\"frames_done\":" << frames << ",\"frames_total\":" << frames_total
+                 << ",\"bytes_done\":" << bytes << ",\"bytes_total\":" << bytes_total
+                 << fixed << setprecision(2) << ",\"mb_per_s\":" << mb_per_sec
+                 << ",\"frames_per_s\":" << frames_per_sec << ",\"elapsed_s\":" << elapsed;
+            if (known) cerr << ",\"eta_s\":" << eta;
+            cerr << "}" << endl;
+            return;
+        }
+
+        cerr << "\r";
+        if (known && bytes_total > 0) {
+            cerr << "[" << fixed << setprecision(1) << setw(5) << 100.0 * bytes / bytes_total << "%] "
+                 << frames << "/" << frames_total << " frames";
+        } else {
+            cerr << frames << " frames";
+        }
+        cerr << fixed << setprecision(1) << "  " << mb_per_sec << " MB/s  " << frames_per_sec << " frames/s";
+        if (known) {
+            auto seconds = static_cast<long>(eta + 0.5);
+            cerr << "  ETA " << setfill('0') << setw(2) << seconds / 3600 << ":" << setw(2) << seconds / 60 % 60
+                 << ":" << setw(2) << seconds % 60 << setfill(' ');
+        }
+        cerr << "   " << flush;
+    }
+
+    const JobQueue &jobs;
+    size_t counted = 0;
+    chrono::steady_clock::time_point started;
+    atomic<uint64_t> frames_total{0};
+    atomic<uint64_t> bytes_total{0};
+    atomic<bool> totals_known{false};
+    bool stopping = false;
+    mutex mtx;
+    condition_variable wake;
+    thread reporter;
+};
+
+// Function to render every counter and stage latency histogram in the Prometheus text format
+string render_metrics() {
+    ostringstream out;
+    auto counter = [&](const string &name, const string &help, uint64_t value, const string &labels = "") {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n"
+            << name << labels << " " << value << "\n";
+    };
+
+    out << "# HELP dv2str_files_total Files processed, by result.\n# TYPE dv2str_files_total counter\n"
+        << "dv2str_files_total{result=\"ok\"} " << run_counters.files_ok << "\n"
+        << "dv2str_files_total{result=\"failed\"} " << run_counters.files_failed << "\n";
+    counter("dv2str_frames_total", "DV frames decoded.", progress.frames.load(memory_order_relaxed));
+    counter("dv2str_bytes_total", "Bytes of DV frames decoded.", progress.bytes.load(memory_order_relaxed));
+    counter("dv2str_frames_rejected_total", "DV frames without a valid recording date and time.",
+            run_counters.frames_rejected.load(memory_order_relaxed));
+    counter("dv2str_sparse_skipped_bytes_total", "Bytes of sparse-file holes skipped without reading.",
+            sparse_skipped_bytes.load(memory_order_relaxed));
+    counter("dv2str_read_errors_total", "Frame reads that returned fewer bytes than indexed.",
+            run_counters.read_errors.load(memory_order_relaxed));
+
+    // Fixed bucket bounds from 10 us to 10 s, derived from the finer HDR histograms
+    const double bounds[] = {1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2,
+                             2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    out << "# HELP dv2str_stage_latency_seconds Per-frame latency of each pipeline stage.\n"
+        << "# TYPE dv2str_stage_latency_seconds histogram\n";
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        StageStats totals = stats_report->stage_totals(static_cast<Stage>(stage));
+        string label = string("stage=\"") + STAGE_NAMES[stage] + "\"";
+        for (double bound : bounds) {
+            out << "dv2str_stage_latency_seconds_bucket{" << label << ",le=\"" << bound << "\"} "
+                << totals.latency.count_at_most(static_cast<uint64_t>(bound * 1e9)) << "\n";
+        }
+        out << "dv2str_stage_latency_seconds_bucket{" << label << ",le=\"+Inf\"} " << totals.latency.count() << "\n"
+            << "dv2str_stage_latency_seconds_sum{" << label << "} " << totals.nanoseconds / 1e9 << "\n"
+            << "dv2str_stage_latency_seconds_count{" << label << "} " << totals.latency.count() << "\n";
+    }
+
+    // Lookup service only: how long each priority class waits for a decode slot
+    if (decode_scheduler) {
+        auto classes = decode_scheduler->snapshot();
+        out << "# HELP dv2str_scheduler_queued_jobs Decode jobs waiting for a slot, by priority class.\n"
+            << "# TYPE dv2str_scheduler_queued_jobs gauge\n";
+        for (int i = 0; i < PRIORITY_COUNT; ++i) {
+            out << "dv2str_scheduler_queued_jobs{class=\"" << PRIORITY_NAMES[i] << "\"} " << classes[i].queued << "\n";
+        }
+        out << "# HELP dv2str_scheduler_running_jobs Decode jobs holding a slot, by priority class.\n"
+            << "# TYPE dv2str_scheduler_running_jobs gauge\n";
+        for (int i = 0; i < PRIORITY_COUNT; ++i) {
+            out << "dv2str_scheduler_running_jobs{class=\"" << PRIORITY_NAMES[i] << "\"} " << classes[i].running << "\n";
+        }
+        out << "# HELP dv2str_scheduler_preemptions_total Slots given up at a frame-batch boundary, by priority class.\n"
+            << "# TYPE dv2str_scheduler_preemptions_total counter\n";
+        for (int i = 0; i < PRIORITY_COUNT; ++i) {
+            out << "dv2str_scheduler_preemptions_total{class=\"" << PRIORITY_NAMES[i] << "\"} " << classes[i].preemptions << "\n";
+        }
+        out << "# HELP dv2str_scheduler_wait_seconds Time from queuing to getting a decode slot, by priority class.\n"
+            << "# TYPE dv2str_scheduler_wait_seconds histogram\n";
+        for (int i = 0; i < PRIORITY_COUNT; ++i) {
+            string label = string("class=\"") + PRIORITY_NAMES[i] + "\"";
+            for (double bound : bounds) {
+                out << "dv2str_scheduler_wait_seconds_bucket{" << label << ",le=\"" << bound << "\"} "
+                    << classes[i].wait.count_at_most(static_cast<uint64_t>(bound * 1e9)) << "\n";
+            }
+            out << "dv2str_scheduler_wait_seconds_bucket{" << label << ",le=\"+Inf\"} " << classes[i].wait.count() << "\n"
+                << "dv2str_scheduler_wait_seconds_sum{" << label << "} " << classes[i].wait_nanoseconds / 1e9 << "\n"
+                << "dv2str_scheduler_wait_seconds_count{" << label << "} " << classes[i].wait.count() << "\n";
+        }
+    }
+    return out.str();
+}
+
+// Function to write the metrics for the textfile collector; the rename keeps scrapes from seeing a partial file
+bool write_metrics_file(const string &path, double elapsed_seconds) {
+    string temp_path = path + ".tmp";
+    {
+        ofstream out(temp_path);
+        if (!out) return false;
+        out << render_metrics()
+            << "# HELP dv2str_run_duration_seconds Wall time of the last run.\n"
+            << "# TYPE dv2str_run_duration_seconds gauge\n"
+            << "dv2str_run_duration_seconds " << elapsed_seconds << "\n"
+            << "# HELP dv2str_last_run_timestamp_seconds Unix time the last run finished.\n"
+            << "# TYPE dv2str_last_run_timestamp_seconds gauge\n"
+            << "dv2str_last_run_timestamp_seconds "
+            << chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count() << "\n";
+        if (!out) return false;
+    }
+    return rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+// Function to write the per-frame results of a run to a --frames-file, each file's records straight
+// from its result buffer. The file is replaced atomically, like the metrics file.
+bool write_frame_records(const string &path, vector<vector<FrameRecord>> &records, const vector<string> &paths) {
+    FrameFileHeader header;
+    header.files = static_cast<uint32_t>(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        for (auto &record : records[i]) record.file = static_cast<uint32_t>(i);
+        header.records += records[i].size();
+    }
+    header.paths_offset = sizeof(header) + header.records * sizeof(FrameRecord);
+
+    string temp_path = path + ".tmp";
+    {
+        ofstream out(temp_path, ios::binary);
+        if (!out) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto &file_records : records) {
+            out.write(reinterpret_cast<const char*>(file_records.data()), file_records.size() * sizeof(FrameRecord));
+        }
+        for (const auto &file_path : paths) out.write(file_path.c_str(), file_path.size() + 1);
+        if (!out) return false;
+    }
+    return rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+#ifdef __linux__
+// Function to listen on a Unix socket path, replacing a stale socket left by an earlier run
+int listen_unix(const string &path, int backlog = 4) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, backlog) != 0)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        fd = -1;
+    }
+    return fd;
+}
+
+// Function to listen on "unix:<path>" or on a TCP port of the loopback interface; -1 on error
+int listen_address(const string &address) {
+    if (address.rfind("unix:", 0) == 0) return listen_unix(address.substr(5), 16);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(atoi(address.c_str())));
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (fd >= 0 && (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        fd = -1;
+    }
+    return fd;
+}
+
+// Function to send a whole buffer, giving up when the client goes away
+void send_all(int fd, const string &data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+    }
+}
+
+const int CLIENT_TIMEOUT_MS = 5000; // Connections that send nothing for this long are dropped
+
+// Function to receive a client's request, giving up after CLIENT_TIMEOUT_MS or as soon as stopping
+// is set; polled in short steps so shutdown never waits for an idle client. Sends to the client are
+// bounded by the same timeout. Returns the bytes received, or -1 if nothing came.
+ssize_t receive_request(int client, char *buffer, size_t size, const atomic<bool> *stopping = nullptr) {
+    timeval timeout{CLIENT_TIMEOUT_MS / 1000, (CLIENT_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(CLIENT_TIMEOUT_MS);
+    while (!(stopping && *stopping) && chrono::steady_clock::now() < deadline) {
+        pollfd pfd{client, POLLIN, 0};
+        int ready = poll(&pfd, 1, 200);
+        if (ready > 0) return recv(client, buffer, size, MSG_DONTWAIT);
+        if (ready < 0 && errno != EINTR) break;
+    }
+    return -1;
+}
+#endif
+
+// Minimal HTTP endpoint answering GET /metrics on a local TCP port or a Unix socket
+class MetricsServer {
+public:
+    explicit MetricsServer(const string &address) {
+#ifdef __linux__
+        if (address.rfind("unix:", 0) == 0) socket_path = address.substr(5);
+        fd = listen_address(address);
+        if (fd < 0) cerr << "Could not listen for metrics on " << address << ": " << strerror(errno) << endl;
+        if (fd >= 0) server = thread(&MetricsServer::run, this);
+#else
+        cerr << "Metrics endpoint is not supported on this platform" << endl;
+#endif
+    }
+
+    ~MetricsServer() {
+#ifdef __linux__
+        stopping = true;
+        if (server.joinable()) server.join();
+        if (fd >= 0) close(fd);
+        if (!socket_path.empty()) unlink(socket_path.c_str());
+#endif
+    }
+
+private:
+#ifdef __linux__
+    void run() {
+        while (!stopping) {
+            pollfd pfd{fd, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0) continue;
+            int client = accept(fd, nullptr, nullptr);
+            if (client < 0) continue;
+
+            char request[1024];
+            ssize_t received = receive_request(client, request, sizeof(request) - 1, &stopping);
+            if (received <= 0) {
+                close(client); // Idle client, or shutting down
+                continue;
+            }
+            request[received] = '\0';
+            bool found = strncmp(request, "GET /metrics", 12) == 0;
+            string body = found ? render_metrics() : "Not found\n";
+            string response = string("HTTP/1.0 ") + (found ? "200 OK" : "404 Not Found") +
+                              "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                              to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            send_all(client, response);
+            close(client);
+        }
+    }
+
+    int fd = -1;
+    string socket_path;
+    atomic<bool> stopping{false};
+    thread server;
+#endif
+};
+
+#ifdef __linux__
+// Shared-memory frame ring between a capture process and 'dv2str ingest'. The ingest side
+// creates the ring (a memfd) and two eventfds and hands all three to each producer that connects
+// to its Unix socket. The producer copies a frame into the next free slot, publishes it by
+// advancing head and signals frames_ready; dv2str decodes the frame where it lies, advances tail
+// and signals slots_free. Single producer, single consumer: each index has one writer.
+const uint32_t RING_MAGIC = 0x49525644; // "DVRI"
+const uint32_t RING_SLOTS = 16;
+const size_t RING_HEADER_SIZE = 4096;
+const size_t RING_SLOT_SIZE = (64 + MAX_FRAME_SIZE + 4095) / 4096 * 4096;
+
+static_assert(atomic<uint64_t>::is_always_lock_free, "ring indexes must be lock-free to be shared");
+
+struct RingHeader {
+    uint32_t magic;
+    uint32_t slots;
+    uint64_t slot_size;
+    alignas(64) atomic<uint64_t> head; // Frames published by the producer
+    alignas(64) atomic<uint64_t> tail; // Frames released by the consumer
+    alignas(64) atomic<uint32_t> closed; // Set by the producer after its last frame
+};
+
+struct RingSlot {
+    uint32_t size;
+    char stream_id[4];
+    uint64_t sequence;
+    alignas(64) uint8_t data[1];
+};
+
+// Mapping of a ring, shared by both sides
+class FrameRing {
+public:
+    FrameRing() = default;
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    ~FrameRing() {
+        if (base != MAP_FAILED) munmap(base, length);
+        for (int fd : {memory_fd, ready_fd, free_fd}) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    // Function to create a new ring to hand to a producer
+    bool create() {
+        length = RING_HEADER_SIZE + RING_SLOTS * RING_SLOT_SIZE;
+        memory_fd = memfd_create("dv2str-ring", MFD_CLOEXEC);
+        ready_fd = eventfd(0, EFD_CLOEXEC);
+        free_fd = eventfd(0, EFD_CLOEXEC);
+        if (memory_fd < 0 || ready_fd < 0 || free_fd < 0 || ftruncate(memory_fd, length) != 0 || !map()) return false;
+        header = new (base) RingHeader{RING_MAGIC, RING_SLOTS, RING_SLOT_SIZE, {0}, {0}, {0}};
+        return true;
+    }
+
+    // Function to map a ring received from the ingest side, checking its layout
+    bool attach(int memory, int ready, int free) {
+        memory_fd = memory;
+        ready_fd = ready;
+        free_fd = free;
+        struct stat info{};
+        if (fstat(memory_fd, &info) != 0 || static_cast<size_t>(info.st_size) < RING_HEADER_SIZE) return false;
+        length = info.st_size;
+        if (!map()) return false;
+        header = reinterpret_cast<RingHeader*>(base);
+        return header->magic == RING_MAGIC && header->slot_size >= 64 + MAX_FRAME_SIZE &&
+               length >= RING_HEADER_SIZE + header->slots * header->slot_size;
+    }
+
+    RingSlot *slot(uint64_t index) {
+        return reinterpret_cast<RingSlot*>(static_cast<uint8_t*>(base) + RING_HEADER_SIZE +
+                                           (index % header->slots) * header->slot_size);
+    }
+
+    // Function to wake the other side; the counter value itself is never used
+    static void signal(int fd) {
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Function to wait for a signal on fd, or for the peer socket to hang up; false on hang-up
+    static bool wait(int fd, int peer) {
+        pollfd fds[2] = {{fd, POLLIN, 0}, {peer, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) return errno == EINTR;
+        if (fds[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t received = read(fd, &count, sizeof(count));
+            (void)received;
+            return true;
+        }
+        char byte;
+        return !(fds[1].revents & (POLLHUP | POLLERR)) && recv(peer, &byte, 1, MSG_DONTWAIT) != 0;
+    }
+
+    RingHeader *header = nullptr;
+    int memory_fd = -1, ready_fd = -1, free_fd = -1;
+
+private:
+    bool map() {
+        base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+        return base != MAP_FAILED;
+    }
+
+    void *base = MAP_FAILED;
+    size_t length = 0;
+};
+
+// Function to serve producers one after another, decoding their frames in the shared ring
+// without copying and printing each new timecode as soon as it is seen. Runs until killed.
+bool ingest_frames(const string &socket_path) {
+    int listener = listen_unix(socket_path);
+    if (listener < 0) {
+        cerr << "Could not listen on " << socket_path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    cerr << "Waiting for producers on " << socket_path << endl;
+
+    for (size_t session = 1;; ++session) {
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Error accepting producer: " << strerror(errno) << endl;
+            break;
+        }
+
+        // A fresh ring per producer, so a crashed producer can't leave stale indexes behind
+        FrameRing ring;
+        if (!ring.create()) {
+            cerr << "Error creating frame ring: " << strerror(errno) << endl;
+            close(client);
+            continue;
+        }
+        char tag = 'R';
+        iovec payload{&tag, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+        msghdr message{};
+        message.msg_iov = &payload;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr *rights = CMSG_FIRSTHDR(&message);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type = SCM_RIGHTS;
+        rights->cmsg_len = CMSG_LEN(3 * sizeof(int));
+        int fds[3] = {ring.memory_fd, ring.ready_fd, ring.free_fd};
+        memcpy(CMSG_DATA(rights), fds, sizeof(fds));
+        if (sendmsg(client, &message, MSG_NOSIGNAL) != 1) {
+            close(client);
+            continue;
+        }
+
+        cout << "Session: " << session << endl;
+        vector<Timecode> timecodes;
+        uint64_t frames = 0, rejected = 0;
+        RingHeader *header = ring.header;
+        bool finished = false;
+        while (true) {
+            uint64_t tail = header->tail.load(memory_order_relaxed);
+            if (tail == header->head.load(memory_order_acquire)) {
+                if (finished) break;
+                // Closed (or hung up) after its last publication, so one more look at head drains the ring
+                finished = header->closed.load(memory_order_acquire) || !FrameRing::wait(ring.ready_fd, client);
+                continue;
+            }
+
+            RingSlot *slot = ring.slot(tail);
+            size_t size = min<size_t>(slot->size, header->slot_size - offsetof(RingSlot, data));
+            auto results = get_dv_recording_time(slot->data, size, string(slot->stream_id, 4), slot->sequence);
+            header->tail.store(tail + 1, memory_order_release);
+            FrameRing::signal(ring.free_fd);
+
+            frames++;
+            if (!results) {
+                rejected++;
+            } else if (find(timecodes.begin(), timecodes.end(), *results) == timecodes.end()) {
+                timecodes.push_back(*results);
+                print_timecode(*results);
+            }
+        }
+        close(client);
+        if (debug) cerr << "Session " << session << ": " << frames << " frames, " << rejected << " rejected" << endl;
+    }
+    close(listener);
+    return false;
+}
+
+// Function to act as a capture application for testing 'dv2str ingest': the DV frames of an
+// AVI file are written into the ring offered on socket_path, blocking while the ring is full
+bool produce_frames(const string &socket_path, const string &file_path) {
+    ifstream file(file_path, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Error opening file: " << file_path << endl;
+        return false;
+    }
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        cerr << "Could not connect to " << socket_path << ": " << strerror(errno) << endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    char tag = 0;
+    iovec payload{&tag, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &payload;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *rights = recvmsg(fd, &message, MSG_CMSG_CLOEXEC) == 1 ? CMSG_FIRSTHDR(&message) : nullptr;
+    FrameRing ring;
+    int fds[3];
+    if (!rights || rights->cmsg_type != SCM_RIGHTS || rights->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        cerr << "No frame ring received from " << socket_path << endl;
+        close(fd);
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(rights), sizeof(fds));
+    if (!ring.attach(fds[0], fds[1], fds[2])) {
+        cerr << "Invalid frame ring received from " << socket_path << endl;
+        close(fd);
+        return false;
+    }
+
+    RingHeader *header = ring.header;
+    uint64_t sent = 0;
+    bool connected = true;
+    file.seekg(0, ios::end);
+    uint64_t size = file.tellg();
+    file.seekg(0);
+    walk_avi_stream(file, size, file_path, [&](const string &chunk_id, uint64_t offset, const vector<uint8_t> &frame) {
+        uint64_t head = header->head.load(memory_order_relaxed);
+        while (connected && head - header->tail.load(memory_order_acquire) >= header->slots) {
+            connected = FrameRing::wait(ring.free_fd, fd);
+        }
+        if (!connected) return;
+        RingSlot *slot = ring.slot(head);
+        memcpy(slot->data, frame.data(), frame.size());
+        slot->size = frame.size();
+        memcpy(slot->stream_id, chunk_id.data(), 4);
+        slot->sequence = offset;
+        header->head.store(head + 1, memory_order_release);
+        FrameRing::signal(ring.ready_fd);
+        sent++;
+    });
+    header->closed.store(1, memory_order_release);
+    FrameRing::signal(ring.ready_fd);
+    close(fd);
+
+    cerr << file_path << ": " << sent << " frames sent" << (connected ? "" : " before the consumer went away") << endl;
+    return connected;
+}
+#endif
+
+#ifdef __linux__
+// Size-bounded LRU cache of decoded files for 'dv2str serve', shared by all request threads.
+// Entries are keyed by path and only served while the file's device, inode, size and mtime
+// still match, so a replaced or rewritten file is decoded again.
+class IndexCache {
+public:
+    explicit IndexCache(size_t capacity) : capacity(capacity) {}
+
+    // Returns the file's timecodes, decoding it only on a miss; false if it could not be read
+    bool get(const string &path, vector<Timecode> &timecodes, bool &hit) {
+        struct stat info{};
+        if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return false;
+        Identity identity{uint64_t(info.st_dev), uint64_t(info.st_ino), uint64_t(info.st_size),
+                          int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec};
+        DecodingSlot decoded{*this, path, identity};
+        {
+            unique_lock<mutex> lock(mtx);
+            auto it = entries.find(path);
+            hit = it != entries.end() && it->second->identity == identity;
+            if (hit) {
+                lru.splice(lru.begin(), lru, it->second); // Most recently used first
+                timecodes = it->second->timecodes;
+                hits++;
+                return true;
+            }
+            misses++;
+
+            // A miss on a file that is already being decoded waits for that decode instead of repeating it
+            auto running = decoding.find(path);
+            if (running != decoding.end() && running->second.identity == identity) {
+                shared_future<optional<vector<Timecode>>> result = running->second.result;
+                joined++;
+                lock.unlock();
+                if (!result.get()) return false;
+                timecodes = *result.get();
+                return true;
+            }
+            decoding[path] = {identity, decoded.result.get_future().share()};
+            decoded.registered = true;
+        }
+
+        // Decoded outside the lock so hits on other files aren't held up by a slow decode
+        uint64_t failed = run_counters.files_failed;
+        try {
+            ScheduledDecode slot;
+            timecodes = parse_avi_file(path);
+        } catch (const exception &error) {
+            cerr << "Error decoding " << path << ": " << error.what() << endl;
+            return false;
+        }
+        if (run_counters.files_failed != failed) return false;
+        decoded.value = timecodes;
+
+        lock_guard<mutex> lock(mtx);
+        auto it = entries.find(path);
+        if (it != entries.end()) remove(it);
+        size_t bytes = path.size() + timecodes.size() * sizeof(Timecode) + sizeof(Entry);
+        if (bytes > capacity) return true; // Too large to cache at all
+        lru.push_front({path, identity, timecodes, bytes});
+        entries[path] = lru.begin();
+        used += bytes;
+        while (used > capacity) {
+            remove(entries.find(lru.back().path));
+            evictions++;
+        }
+        return true;
+    }
+
+    string statistics() {
+        lock_guard<mutex> lock(mtx);
+        ostringstream out;
+        out << "entries " << entries.size() << "\nbytes " << used << "\ncapacity " << capacity
+            << "\nhits " << hits << "\nmisses " << misses << "\njoined " << joined << "\nevictions " << evictions << "\n";
+        return out.str();
+    }
+
+private:
+    struct Identity {
+        uint64_t device, inode, size;
+        int64_t mtime_ns;
+        bool operator==(const Identity &other) const {
+            return device == other.device && inode == other.inode && size == other.size && mtime_ns == other.mtime_ns;
+        }
+    };
+
+    struct Entry {
+        string path;
+        Identity identity;
+        vector<Timecode> timecodes;
+        size_t bytes;
+    };
+
+    // Decode in progress, shared with the misses that arrive while it runs; nullopt if it failed
+    struct Decoding {
+        Identity identity;
+        shared_future<optional<vector<Timecode>>> result;
+    };
+
+    // Owner's side of a Decoding. On every exit path, including exceptions, it removes the entry and
+    // hands the waiters value, which stays nullopt unless the decode succeeded.
+    struct DecodingSlot {
+        IndexCache &cache;
+        const string &path;
+        Identity identity;
+        promise<optional<vector<Timecode>>> result;
+        optional<vector<Timecode>> value;
+        bool registered = false; // Only the miss that started the decode settles it
+
+        ~DecodingSlot() {
+            if (!registered) return;
+            lock_guard<mutex> lock(cache.mtx);
+            auto running = cache.decoding.find(path);
+            if (running != cache.decoding.end() && running->second.identity == identity) cache.decoding.erase(running);
+            result.set_value(move(value));
+        }
+    };
+
+    void remove(unordered_map<string, list<Entry>::iterator>::iterator it) {
+        used -= it->second->bytes;
+        lru.erase(it->second);
+        entries.erase(it);
+    }
+
+    size_t capacity;
+    size_t used = 0;
+    uint64_t hits = 0, misses = 0, joined = 0, evictions = 0; // joined: misses served by a decode in progress
+    mutex mtx;
+    list<Entry> lru;
+    unordered_map<string, list<Entry>::iterator> entries;
+    unordered_map<string, Decoding> decoding;
+};
+
+// Function to decode %XX escapes and '+' in a query string value
+string url_decode(const string &text) {
+    string decoded;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '%' && i + 2 < text.size() && isxdigit(text[i + 1]) && isxdigit(text[i + 2])) {
+            decoded += static_cast<char>(stoi(text.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            decoded += text[i] == '+' ? ' ' : text[i];
+        }
+    }
+    return decoded;
+}
+
+// Function to get a parameter from a query string such as "path=a.avi&priority=bulk"
+string query_parameter(const string &query, const string &name) {
+    for (size_t start = 0; start < query.size();) {
+        size_t end = query.find('&', start);
+        if (end == string::npos) end = query.size();
+        string pair = query.substr(start, end - start);
+        if (pair.rfind(name + "=", 0) == 0) return url_decode(pair.substr(name.size() + 1));
+        start = end + 1;
+    }
+    return "";
+}
+
+// Function to name the client a connection comes from, for fair sharing: the peer's user for Unix
+// sockets and its address for TCP, unless the request names itself with client=
+string peer_name(int client) {
+    ucred credentials{};
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0 && credentials.pid > 0) {
+        sockaddr_storage address{};
+        socklen_t address_length = sizeof(address);
+        if (getpeername(client, reinterpret_cast<sockaddr*>(&address), &address_length) == 0 && address.ss_family == AF_UNIX) {
+            return "uid:" + to_string(credentials.uid);
+        }
+    }
+    sockaddr_in address{};
+    socklen_t address_length = sizeof(address);
+    char text[INET_ADDRSTRLEN] = "unknown";
+    if (getpeername(client, reinterpret_cast<sockaddr*>(&address), &address_length) == 0 && address.sin_family == AF_INET) {
+        inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text));
+    }
+    return text;
+}
+
+atomic<bool> rescan_running{false}; // One rescan at a time; others are refused until it is done
+
+// Function to decode every DV AVI under a directory into the cache
+void rescan_directory(const string &directory, SchedulerTicket ticket, IndexCache &cache) {
+    vector<string> files = collect_avi_files({directory}, true);
+    scheduler_ticket = &ticket;
+    size_t decoded = 0;
+    for (const auto &path : files) {
+        vector<Timecode> timecodes;
+        bool hit = false;
+        decoded += cache.get(path, timecodes, hit) && !hit;
+    }
+    scheduler_ticket = nullptr;
+    cerr << "Rescan of " << directory << " finished: " << files.size() << " files, " << decoded << " decoded" << endl;
+    rescan_running = false;
+}
+
+// Function to answer one HTTP request: GET /timecodes?path=<file>, /rescan?path=<dir>, /cache or /metrics.
+// Lookups and rescans take priority=interactive|normal|bulk (default normal for lookups, bulk for rescans).
+void serve_request(int client, IndexCache &cache) {
+    char request[4096];
+    ssize_t received = receive_request(client, request, sizeof(request) - 1);
+    if (received <= 0) return; // Idle connections are closed without an answer
+    request[received] = '\0';
+    string line(request, strcspn(request, "\r\n"));
+    string target = line.rfind("GET ", 0) == 0 ? line.substr(4, line.find(' ', 4) - 4) : "";
+    size_t question = target.find('?');
+    string resource = target.substr(0, question);
+    string query = question == string::npos ? "" : target.substr(question + 1);
+
+    SchedulerTicket ticket;
+    ticket.priority = resource == "/rescan" ? PRIORITY_BULK : PRIORITY_NORMAL;
+    string priority = query_parameter(query, "priority");
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+        if (priority == PRIORITY_NAMES[i]) ticket.priority = static_cast<Priority>(i);
+    }
+    ticket.client = query_parameter(query, "client");
+    if (ticket.client.empty()) ticket.client = peer_name(client);
+
+    string status = "200 OK", body;
+    string path = query_parameter(query, "path");
+    if (resource == "/timecodes" && !path.empty()) {
+        scheduler_ticket = &ticket;
+        vector<Timecode> timecodes;
+        bool hit = false;
+        auto started = chrono::steady_clock::now();
+        if (!cache.get(path, timecodes, hit)) {
+            status = "404 Not Found";
+            body = "Could not read " + path + "\n";
+        } else {
+            ostringstream out;
+            for (const auto &timecode : timecodes) print_timecode(timecode, out);
+            body = out.str();
+            if (debug) {
+                cerr << path << ": " << (hit ? "cache hit" : "decoded") << " for " << ticket.client << " ("
+                     << PRIORITY_NAMES[ticket.priority] << ") in "
+                     << chrono::duration<double, micro>(chrono::steady_clock::now() - started).count() << " us" << endl;
+            }
+        }
+        scheduler_ticket = nullptr;
+    } else if (resource == "/rescan" && !path.empty()) {
+        if (rescan_running.exchange(true)) {
+            status = "409 Conflict";
+            body = "A rescan is already running\n";
+        } else {
+            thread(rescan_directory, path, ticket, ref(cache)).detach();
+            body = "Rescan of " + path + " started (" + PRIORITY_NAMES[ticket.priority] + ")\n";
+        }
+    } else if (resource == "/cache") {
+        body = cache.statistics();
+    } else if (resource == "/metrics") {
+        body = render_metrics();
+    } else {
+        status = target.empty() ? "400 Bad Request" : "404 Not Found";
+        body = "Use GET /timecodes?path=<file>, /rescan?path=<directory>, /cache or /metrics\n";
+    }
+    send_all(client, "HTTP/1.0 " + status + "\r\nContent-Type: text/plain\r\nContent-Length: " +
+                     to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+}
+
+// Function to run as a long-lived lookup service: each connection is answered on its own
+// thread, and repeated lookups of unchanged files come from the shared cache. Runs until killed.
+// Decodes run in -j slots (DecodeScheduler), so interactive lookups overtake rescans.
+bool serve_lookups(const string &address, size_t cache_size) {
+    int listener = listen_address(address);
+    if (listener < 0) {
+        cerr << "Could not listen on " << address << ": " << strerror(errno) << endl;
+        return false;
+    }
+    cerr << "Serving lookups on " << address << " with a " << cache_size / (1024 * 1024) << " MB cache" << endl;
+
+    IndexCache cache(cache_size);
+    DecodeScheduler scheduler(jobs);
+    decode_scheduler = &scheduler;
+    StatsReport report; // For the stage latencies in /metrics
+    stats_report = &report;
+    store_summaries = false; // A GET must not write to the files it reads
+    const int MAX_CLIENTS = 64;
+    atomic<int> clients{0};
+    while (true) {
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            cerr << "Error accepting connection: " << strerror(errno) << endl;
+            break;
+        }
+        if (clients >= MAX_CLIENTS) {
+            send_all(client, "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+            close(client);
+            continue;
+        }
+        clients++;
+        thread([client, &cache, &clients] {
+            serve_request(client, cache);
+            close(client);
+            clients--;
+        }).detach();
+    }
+    close(listener);
+    return false;
+}
+#endif
+
+#ifdef DV2STR_ALLOC_ACCOUNTING
+// Function to print the allocations counted in each stage, per frame when --stats timed the stages
+void print_allocations() {
+    cerr << "Heap allocations:" << endl;
+    for (int stage = 0; stage <= STAGE_COUNT; ++stage) {
+        uint64_t allocations = alloc_counters[stage].allocations.load();
+        uint64_t bytes = alloc_counters[stage].bytes.load();
+        cerr << left << setw(8) << (stage < STAGE_COUNT ? STAGE_NAMES[stage] : "other") << right
+             << setw(12) << allocations << " allocs" << setw(14) << bytes << " bytes";
+        if (stage < STAGE_COUNT && stats_report) {
+            uint64_t frames = stats_report->stage_totals(static_cast<Stage>(stage)).calls;
+            if (frames) {
+                cerr << fixed << setprecision(2) << setw(10) << double(allocations) / frames << " allocs/frame"
+                     << setw(12) << double(bytes) / frames << " bytes/frame";
+            }
+        }
+        cerr << endl;
+    }
+}
+#endif
+
+// Function to parse sizes such as 512K, 64M or 2G into bytes
+size_t parse_size(const string &text) {
+    char *end = nullptr;
+    double value = strtod(text.c_str(), &end);
+    switch (toupper(*end)) {
+        case 'K': value *= 1024; break;
+        case 'M': value *= 1024 * 1024; break;
+        case 'G': value *= 1024.0 * 1024 * 1024; break;
+        default: break;
+    }
+    return value > 0 ? static_cast<size_t>(value) : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "dv2str <video_file_path> [more_files...] <-debug> <-j n> <--depth n> <--max-memory size>" << endl;
+        cerr << "dv2str inspect <video_file_path>... [-d]" << endl;
+        cerr << "dv2str validate <video_file_path>..." << endl;
+        cerr << "dv2str carve <disk_image_or_device> <output_directory>" << endl;
+        cerr << "dv2str tar <archive.tar|->..." << endl;
+        cerr << "dv2str catalog <file_or_directory>..." << endl;
+        cerr << "dv2str probe <video_file_path>..." << endl;
+        cerr << "dv2str serve <port|unix:path> [--cache-size size]" << endl;
+        cerr << "dv2str ingest <socket_path>" << endl;
+        cerr << "dv2str produce <socket_path> <video_file_path>" << endl;
+        return 1;
+    }
+
+    if (string(argv[1]) == "inspect") {
+        vector<string> paths;
+        for (int i = 2; i < argc; ++i) {
+            if (string(argv[i]) == "-debug" || string(argv[i]) == "-d") {
+                debug = true;
+            } else {
+                paths.push_back(argv[i]);
+            }
+        }
+        bool ok = !paths.empty();
+        for (const auto &path : paths) ok = inspect_avi_file(path) && ok;
+        return ok ? 0 : 1;
+    }
+
+    if (string(argv[1]) == "carve") {
+        if (argc != 4) {
+            cerr << "dv2str carve <disk_image_or_device> <output_directory>" << endl;
+            return 1;
+        }
+        return carve_dv_frames(argv[2], argv[3]) ? 0 : 1;
+    }
+
+    if (string(argv[1]) == "tar") {
+        bool ok = argc > 2;
+        for (int i = 2; i < argc; ++i) {
+            if (string(argv[i]) == "-debug" || string(argv[i]) == "-d") {
+                debug = true;
+                continue;
+            }
+            ok = process_tar_stream(argv[i]) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (string(argv[1]) == "catalog" || string(argv[1]) == "probe") {
+        // Stale or missing summaries are rebuilt by a normal decode, which needs the memory budget
+        MemoryBudget budget(0);
+        memory_budget = &budget;
+        vector<string> paths;
+        for (int i = 2; i < argc; ++i) {
+            if (string(argv[i]) == "-debug" || string(argv[i]) == "-d") {
+                debug = true;
+            } else {
+                paths.push_back(argv[i]);
+            }
+        }
+        bool ok = !paths.empty();
+        if (string(argv[1]) == "catalog") {
+            ok = catalog_files(paths) && ok;
+        } else {
+            for (const auto &path : paths) ok = probe_file(path) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (string(argv[1]) == "serve") {
+        jobs = max(1u, thread::hardware_concurrency()); // Decode slots
+        if (argc < 3) {
+            cerr << "dv2str serve <port|unix:path> [--cache-size size]" << endl;
+            return 1;
+        }
+        size_t cache_size = 64 * 1024 * 1024;
+        for (int i = 3; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "-debug" || arg == "-d") {
+                debug = true;
+            } else if (arg == "--cache-size" && i + 1 < argc) {
+                cache_size = parse_size(argv[++i]);
+            } else if (arg == "-j" && i + 1 < argc) {
+                jobs = max(1, atoi(argv[++i]));
+            }
+        }
+        MemoryBudget budget(0);
+        memory_budget = &budget;
+#ifdef __linux__
+        return serve_lookups(argv[2], cache_size) ? 0 : 1;
+#else
+        cerr << "The lookup service is not supported on this platform" << endl;
+        return 1;
+#endif
+    }
+
+    if (string(argv[1]) == "ingest" || string(argv[1]) == "produce") {
+        bool ingest = string(argv[1]) == "ingest";
+        for (int i = ingest ? 3 : 4; i < argc; ++i) {
+            if (string(argv[i]) == "-debug" || string(argv[i]) == "-d") debug = true;
+        }
+        if (argc < (ingest ? 3 : 4)) {
+            cerr << (ingest ? "dv2str ingest <socket_path>" : "dv2str produce <socket_path> <video_file_path>") << endl;
+            return 1;
+        }
+#ifdef __linux__
+        return (ingest ? ingest_frames(argv[2]) : produce_frames(argv[2], argv[3])) ? 0 : 1;
+#else
+        cerr << "Shared-memory ingestion is not supported on this platform" << endl;
+        return 1;
+#endif
+    }
+
+    if (string(argv[1]) == "validate") {
+        bool ok = argc > 2;
+        for (int i = 2; i < argc; ++i) ok = validate_avi_file(argv[i]) && ok;
+        return ok ? 0 : 1;
+    }
+
+    vector<string> file_paths, directories;
+    bool jobs_given = false, depth_given = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-debug" || arg == "-d") {
+            debug = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            jobs = max(1, atoi(argv[++i]));
+            jobs_given = true;
+        } else if (arg == "--depth" && i + 1 < argc) {
+            pipeline_depth = max(1, atoi(argv[++i]));
+            depth_given = true;
+        } else if (arg == "--max-memory" && i + 1 < argc) {
+            max_memory = parse_size(argv[++i]);
+        } else if (arg == "--auto") {
+            auto_tune = true;
+        } else if (arg == "--progress") {
+            progress_mode = PROGRESS_TEXT;
+        } else if (arg == "--progress-json") {
+            progress_mode = PROGRESS_JSON;
+        } else if (arg == "--metrics-file" && i + 1 < argc) {
+            metrics_file = argv[++i];
+        } else if (arg == "--metrics-listen" && i + 1 < argc) {
+            metrics_listen = argv[++i];
+        } else if (arg == "--alloc-check") {
+            alloc_check = true;
+        } else if (arg == "--scan-threads" && i + 1 < argc) {
+            scan_threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--write-index") {
+            write_index = true;
+        } else if (arg == "--crawl-threads" && i + 1 < argc) {
+            crawl_threads = max(1, atoi(argv[++i]));
+        } else if (arg == "--frames-file" && i + 1 < argc) {
+            frames_file = argv[++i];
+        } else if (arg == "--numa") {
+            numa_placement = true;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg == "--background") {
+            background = true;
+        } else if (arg == "--max-rate" && i + 1 < argc) {
+            max_rate_mb = max(0.0, atof(argv[++i]));
+        } else if (arg == "--max-iops" && i + 1 < argc) {
+            max_iops = max(0.0, atof(argv[++i]));
+        } else {
+            error_code error;
+            (filesystem::is_directory(arg, error) ? directories : file_paths).push_back(arg);
+        }
+    }
+
+    // A budget below one file's minimum could never be satisfied, so raise it to that
+    size_t minimum = MAX_FRAME_SIZE + MIN_INDEX_WINDOW * sizeof(IndexEntry);
+    if (max_memory != 0 && max_memory < minimum) {
+        cerr << "Warning: --max-memory raised to the minimum of " << minimum << " bytes" << endl;
+        max_memory = minimum;
+    }
+    MemoryBudget budget(max_memory);
+    memory_budget = &budget;
+
+    StatsReport report;
+    if (stats || !metrics_file.empty() || !metrics_listen.empty()) stats_report = &report;
+    auto run_started = chrono::steady_clock::now();
+
+    unique_ptr<MetricsServer> metrics_server;
+    if (!metrics_listen.empty()) metrics_server = make_unique<MetricsServer>(metrics_listen);
+
+    // ioprio is per thread on Linux; reader threads set it again for themselves
+    if (background) set_idle_io_priority();
+
+    unique_ptr<RateLimiter> limiter;
+    if (max_rate_mb > 0 || max_iops > 0) {
+        limiter = make_unique<RateLimiter>(max_rate_mb * 1e6, max_iops);
+        rate_limiter = limiter.get();
+        signal(SIGUSR1, handle_rate_signal);
+        signal(SIGUSR2, handle_rate_signal);
+    }
+
+    // Directories are crawled while the workers already process what has been found
+    JobQueue job_queue;
+    for (const auto &path : file_paths) job_queue.push(path);
+    thread crawl;
+    if (directories.empty()) {
+        job_queue.close();
+    } else {
+        crawl = thread([&] {
+            DirectoryCrawler crawler(directories, crawl_threads, [&](const string &path) { job_queue.push(path); });
+            crawler.wait();
+            if (debug) cerr << "Crawl finished: " << crawler.directories_read() << " directories read" << endl;
+            job_queue.close();
+        });
+    }
+    size_t expected_files = directories.empty() ? file_paths.size() : jobs;
+
+    // Under --auto, -j and --depth are ceilings the tuner climbs towards from 1
+    unique_ptr<ConcurrencyTuner> auto_tuner;
+    if (auto_tune) {
+        if (!jobs_given) jobs = max(1u, thread::hardware_concurrency() * 2);
+        if (!depth_given) pipeline_depth = 32;
+        if (!directories.empty()) expected_files = jobs;
+        auto_tuner = make_unique<ConcurrencyTuner>(min<size_t>(jobs, expected_files), pipeline_depth);
+        tuner = auto_tuner.get();
+        tuner->start();
+    }
+
+    // Files go to whichever worker is free, and so to that worker's node
+    NumaTopology numa;
+    if (numa_placement && debug) {
+        cerr << "NUMA: " << numa.node_count() << " node(s)"
+             << (numa.node_count() < 2 ? ", placement disabled" : "") << endl;
+    }
+
+    vector<vector<Timecode>> timecodes;
+    vector<vector<FrameRecord>> frame_records;
+    mutex timecodes_mtx;
+    auto worker = [&](unsigned index) {
+        if (numa_placement) numa.bind_worker(index);
+        while (true) {
+            if (tuner) tuner->enter_job();
+            size_t i = 0;
+            string path;
+            bool found = job_queue.pop(i, path);
+            if (found) {
+                vector<FrameRecord> records;
+                vector<Timecode> result = parse_avi_file(path, index, nullptr, frames_file.empty() ? nullptr : &records);
+                lock_guard<mutex> lock(timecodes_mtx);
+                if (timecodes.size() <= i) timecodes.resize(i + 1);
+                timecodes[i] = move(result);
+                if (!frames_file.empty()) {
+                    if (frame_records.size() <= i) frame_records.resize(i + 1);
+                    frame_records[i] = move(records);
+                }
+            }
+            if (tuner) tuner->leave_job();
+            if (!found) break;
+        }
+    };
+
+    unique_ptr<ProgressReporter> reporter;
+    if (progress_mode != PROGRESS_OFF) reporter = make_unique<ProgressReporter>(job_queue);
+
+    vector<thread> workers;
+    for (unsigned i = 1; i < min<size_t>(jobs, expected_files); ++i) {
+        workers.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &t : workers) t.join();
+    if (crawl.joinable()) crawl.join();
+    reporter.reset();
+    if (tuner) tuner->stop();
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - run_started).count();
+    if (stats) {
+        stats_report->print(elapsed);
+        if (sparse_skipped_extents) {
+            cerr << "Sparse holes skipped: " << sparse_skipped_extents << " extents, "
+                 << setprecision(1) << sparse_skipped_bytes / 1e6 << " MB" << endl;
+        }
+    }
+    if (!metrics_file.empty() && !write_metrics_file(metrics_file, elapsed)) {
+        cerr << "Error writing metrics file: " << metrics_file << endl;
+    }
+
+    // Results are reported in a stable order: files named on the command line as given, then
+    // the crawled ones sorted by path, since the crawl finds them in whatever order threads steal
+    vector<string> paths(job_queue.size());
+    vector<size_t> order(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        job_queue.path_at(i, paths[i]);
+        order[i] = i;
+    }
+    sort(order.begin() + file_paths.size(), order.end(), [&](size_t a, size_t b) { return paths[a] < paths[b]; });
+    timecodes.resize(paths.size());
+    frame_records.resize(frames_file.empty() ? 0 : paths.size());
+    vector<string> sorted_paths;
+    vector<vector<Timecode>> sorted_timecodes;
+    vector<vector<FrameRecord>> sorted_records;
+    for (size_t i : order) {
+        sorted_paths.push_back(move(paths[i]));
+        sorted_timecodes.push_back(move(timecodes[i]));
+        if (!frames_file.empty()) sorted_records.push_back(move(frame_records[i]));
+    }
+
+    if (!frames_file.empty()) {
+        if (!write_frame_records(frames_file, sorted_records, sorted_paths)) {
+            cerr << "Error writing frames file: " << frames_file << endl;
+        }
+    }
+
+    // Print timecodes
+    for (size_t i = 0; i < sorted_timecodes.size(); ++i) {
+        if (sorted_timecodes.size() > 1) {
+            cout << "File: " << sorted_paths[i] << endl;
+        }
+        for (const auto &timecode : sorted_timecodes[i]) print_timecode(timecode);
+    }
+
+    if (debug) {
+        cerr << "Peak budgeted memory: " << budget.peak_usage() << " bytes" << endl;
+    }
+
+    // The read and decode stages work in preallocated buffers, so any allocation there is a regression
+#ifdef DV2STR_ALLOC_ACCOUNTING
+    if (stats) print_allocations();
+    if (alloc_check) {
+        uint64_t allocations = alloc_counters[STAGE_READ].allocations + alloc_counters[STAGE_DECODE].allocations;
+        if (allocations) {
+            cerr << "Allocation check failed: " << allocations << " allocations in the read/decode loop" << endl;
+            return 1;
+        }
+        cerr << "Allocation check passed" << endl;
+    }
+#else
+    if (alloc_check) {
+        cerr << "--alloc-check needs a build with DV2STR_ALLOC_ACCOUNTING defined (cmake -DDV2STR_ALLOC_ACCOUNTING=ON)" << endl;
+        return 1;
+    }
+#endif
+
+    // Files that could not be opened or parsed still fail the run, as they did before the rework
+    return run_counters.files_failed ? EXIT_FAILURE : 0;
+}
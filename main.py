@@ -1,6 +1,14 @@
+import contextlib
+import io
 import os
 import struct
 import sys
+from concurrent.futures import ProcessPoolExecutor
+
+try:
+    import numpy as np  # Optional: enables the vectorized path in parse_avi_file_numpy
+except ImportError:
+    np = None
 
 '''
 
@@ -516,6 +524,133 @@ def parse_avi_file(file_path):
     return timecodeDates
 
 
+# Frames decoded per batch by the NumPy path, which bounds its temporary arrays to a few hundred MB
+NUMPY_BATCH_FRAMES = 65536
+
+
+def ssyb_pack_offsets(seq_count):
+    """Offsets within a frame of the candidate SSYB packets, in the order get_ssyb_pack visits them."""
+    return np.array([i * 150 * 80 + j * 80 + 3 + k * 8 + 3
+                     for i in range(seq_count) for j in range(2) for k in range(6)], dtype=np.int64)
+
+
+def decode_bcd(values, tens_mask):
+    """Decode an array of BCD bytes whose tens digit is limited to tens_mask."""
+    return (values & 0xf) + 10 * ((values >> 4) & tens_mask)
+
+
+def get_dv_recording_times(data, frame_offsets, frame_size):
+    """Vectorized get_dv_recording_time for frames of one size.
+
+    Returns a mask of the frames with both packets, a mask of those that also pass validation,
+    and their (day, month, year, hour, min, sec) rows.
+    """
+    packet_offsets = ssyb_pack_offsets(12 if frame_size >= 144000 else 10)
+    positions = frame_offsets[:, None] + packet_offsets[None, :]
+    pack_ids = data[positions]
+
+    def first_pack(pack_num):
+        # First matching packet of each frame, like the loop in get_ssyb_pack
+        matches = pack_ids == pack_num
+        found = matches.any(axis=1)
+        starts = positions[np.arange(len(positions)), matches.argmax(axis=1)]
+        return found, data[starts[:, None] + np.arange(2, 5)].astype(np.int64)
+
+    found62, pack62 = first_pack(0x62)
+    found63, pack63 = first_pack(0x63)
+
+    day = decode_bcd(pack62[:, 0], 0x3)
+    month = decode_bcd(pack62[:, 1], 0x1)
+    year = decode_bcd(pack62[:, 2], 0xf)
+    year += np.where(year < 50, 2000, 1900)
+    sec = decode_bcd(pack63[:, 0], 0x7)
+    minute = decode_bcd(pack63[:, 1], 0x7)
+    hour = decode_bcd(pack63[:, 2], 0x3)
+
+    found = found62 & found63
+    valid = (found & (day >= 1) & (day <= 31) & (month >= 1) & (month <= 12) &
+             (year >= 1995) & (year <= 2100) & (sec <= 59) & (minute <= 59) & (hour <= 23))
+    return found, valid, np.stack([day, month, year, hour, minute, sec], axis=1)
+
+
+def parse_avi_file_numpy(file_path):
+    """Same result as parse_avi_file, decoding all frames of the memory-mapped file with array operations."""
+    timecodeDates = []
+    data = np.memmap(file_path, dtype=np.uint8, mode='r')
+
+    with open(file_path, 'rb') as file:
+        parse_riff_header(file)
+
+        # Walk the top-level chunks to the idx1 chunk, as parse_avi_file does
+        while True:
+            chunk_header = file.read(8)
+            if len(chunk_header) < 8:
+                return timecodeDates  # End of file
+
+            chunk_id, chunk_size = struct.unpack('<4sI', chunk_header)
+            if chunk_id == b'idx1':
+                start = file.tell()
+                break
+            file.seek(chunk_size, 1)
+
+    print(f"Found 'idx1' chunk of size {chunk_size} bytes")
+    count = min(chunk_size, max(len(data) - start, 0)) // 16
+    entries = data[start:start + count * 16].view(
+        np.dtype([('stream_id', 'S4'), ('flags', '<u4'), ('offset', '<u4'), ('size', '<u4')]))
+    offsets = entries['offset'].astype(np.int64)
+    sizes = entries['size'].astype(np.int64)
+
+    # Frames running past the end of the file are short reads, which the scalar path rejects too
+    in_file = offsets + sizes <= len(data)
+    found = np.zeros(len(entries), dtype=bool)
+    valid = np.zeros(len(entries), dtype=bool)
+    rows = np.zeros((len(entries), 6), dtype=np.int64)
+    for frame_size in (144000, 120000):  # PAL and NTSC frame sizes
+        frames = np.flatnonzero((sizes == frame_size) & in_file)
+        for batch in range(0, len(frames), NUMPY_BATCH_FRAMES):
+            selected = frames[batch:batch + NUMPY_BATCH_FRAMES]
+            found[selected], valid[selected], rows[selected] = get_dv_recording_times(data, offsets[selected], frame_size)
+
+    if debug:
+        # Printed before validation, like get_dv_recording_time does
+        for row, is_valid in zip(rows[found].tolist(), valid[found].tolist()):
+            day, month, year, hour, minute, sec = row
+            print(f"Timecode: {day:02}/{month:02}/{year} {hour:02}:{minute:02}:{sec:02}")
+            if is_valid:
+                timecodeDates.append(tuple(row))
+        return timecodeDates
+
+    timecodeDates = [tuple(row) for row in rows[valid].tolist()]
+
+    return timecodeDates
+
+
+# Layout of the per-frame records written by `dv2str --frames-file` (FrameRecord in main.cpp)
+FRAME_RECORD_FIELDS = [('file', '<u4'), ('frame', '<u4'), ('offset', '<u8'), ('timestamp', '<i8'),
+                       ('flags', '<u4'), ('reserved', '<u4')]
+FRAME_FILE_HEADER = struct.Struct('<8sIIQQ')
+FRAME_VALID = 1  # The frame carried a valid recording time
+FRAME_SCANNED = 2  # Found by the movi scan rather than through idx1
+
+
+def load_frame_records(path):
+    """Map a --frames-file as a NumPy structured array without copying it, and return it with the file paths.
+
+    Timestamps are seconds since 1970-01-01 of the recorded wall time, e.g. for pandas:
+    pd.DataFrame(records).assign(time=pd.to_datetime(records['timestamp'], unit='s'))
+    """
+    with open(path, 'rb') as file:
+        magic, record_size, files, count, paths_offset = FRAME_FILE_HEADER.unpack(file.read(FRAME_FILE_HEADER.size))
+        dtype = np.dtype(FRAME_RECORD_FIELDS)
+        if magic != b'DV2STRF1' or record_size != dtype.itemsize:
+            raise ValueError(f"{path} is not a dv2str frames file (or was written on a big-endian host)")
+        file.seek(paths_offset)
+        paths = [name.decode('utf-8', errors='replace') for name in file.read().split(b'\0')[:files]]
+
+    records = np.memmap(path, dtype=dtype, mode='r', offset=FRAME_FILE_HEADER.size, shape=(count,))
+    return records, paths
+
+
 def formatSeconds(seconds):
     """
     Format a floating point number (seconds) into the SRT time format: HH:MM:SS,SSS.
@@ -573,7 +708,10 @@ def process_avi_file(file_path):
         print("Invalid file format. Please provide an AVI file.")
         return
 
-    timecodeDates = parse_avi_file(file_path)
+    if np is not None and not no_numpy:
+        timecodeDates = parse_avi_file_numpy(file_path)
+    else:
+        timecodeDates = parse_avi_file(file_path)
     if not timecodeDates:
         print(f"Could not find timecodes in file: {file_path} (ffmpeg cut?)")
         return
@@ -594,24 +732,64 @@ def process_avi_file(file_path):
 
     write_dates_to_srt(sorted_dates, file_path)
 
+def set_options(debug_flag, no_numpy_flag):
+    """Copies the command line options into a pool worker, which may not have run the main block."""
+    global debug, no_numpy
+    debug = debug_flag
+    no_numpy = no_numpy_flag
+
+
+def process_avi_file_captured(file_path):
+    """Runs process_avi_file in a pool worker and returns what it printed, and whether it exited."""
+    output = io.StringIO()
+    with contextlib.redirect_stdout(output):
+        try:
+            process_avi_file(file_path)
+        except SystemExit:
+            return output.getvalue(), True
+    return output.getvalue(), False
+
+
 def process_avi_directory(directory_path):
-    """Processes all AVI files within a directory."""
+    """Processes all AVI files within a directory, in parallel when jobs > 1."""
     print(f"Converting all AVI files in directory: {directory_path}")
+    file_paths = []
     for root, _, files in os.walk(directory_path):
         for file in files:
             if file.endswith(".avi"):
-                full_file_path = os.path.join(root, file)
-                process_avi_file(full_file_path)
+                file_paths.append(os.path.join(root, file))
+
+    if jobs <= 1 or len(file_paths) <= 1:
+        for full_file_path in file_paths:
+            process_avi_file(full_file_path)
+    else:
+        # Largest files are submitted first so that no big file starts last and runs on alone;
+        # each file's output is printed whole, in directory order, as soon as the files before it are done
+        with ProcessPoolExecutor(max_workers=jobs, initializer=set_options, initargs=(debug, no_numpy)) as pool:
+            by_size = sorted(file_paths, key=os.path.getsize, reverse=True)
+            futures = dict(zip(by_size, [pool.submit(process_avi_file_captured, path) for path in by_size]))
+            for full_file_path in file_paths:
+                output, exited = futures[full_file_path].result()
+                print(output, end='', flush=True)
+                if exited:
+                    # Same as the sequential loop: stop at the first file that ends the program
+                    pool.shutdown(cancel_futures=True)
+                    raise SystemExit
 
     print("All AVI files processed.")
 
 fileName = "timecode"
 
 debug = False
+no_numpy = False
+jobs = 1
 
 if __name__ == "__main__":
     file_path = sys.argv[1]
     debug = "-d" in sys.argv
+    no_numpy = "--no-numpy" in sys.argv  # Force the pure Python path even when NumPy is installed
+    if "-j" in sys.argv[:-1]:
+        jobs = max(1, int(sys.argv[sys.argv.index("-j") + 1]))  # Files processed in parallel
 
     #check if file_Path is an AVI file or directory
 